@@ -0,0 +1,181 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+#include <TPL/TPL.h>
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <thread>
+#include <vector>
+
+// Each benchmark is instantiated for both schedulers, the first argument is the number of workers
+
+namespace {
+
+template <class Scheduler>
+std::unique_ptr<Scheduler> MakeScheduler(const benchmark::State& state)
+{
+    return std::make_unique<Scheduler>(static_cast<size_t>(state.range(0)));
+}
+
+template <class Scheduler>
+void BM_SpawnWait(benchmark::State& state)
+{
+    auto scheduler = MakeScheduler<Scheduler>(state);
+    for (auto _ : state) {
+        auto task = tpl::MakeTask([]() { return 1; }, scheduler.get());
+        task.Start();
+        benchmark::DoNotOptimize(task.GetFuture().GetValue());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+/// The second argument is the depth of the chain
+template <class Scheduler>
+void BM_ThenChain(benchmark::State& state)
+{
+    auto scheduler = MakeScheduler<Scheduler>(state);
+    const int64_t depth = state.range(1);
+    for (auto _ : state) {
+        auto first = tpl::MakeTask([]() { return 0; }, scheduler.get());
+        auto last = first;
+        for (int64_t i = 0; i < depth; ++i) {
+            last = last.Then([](const tpl::Task<int>& parent) { return parent.GetFuture().GetValue() + 1; });
+        }
+        first.Start();
+        benchmark::DoNotOptimize(last.GetFuture().GetValue());
+    }
+    state.SetItemsProcessed(state.iterations() * depth);
+}
+
+/// The second argument is the number of the tasks joined by WhenAll
+template <class Scheduler>
+void BM_FanOutFanIn(benchmark::State& state)
+{
+    auto scheduler = MakeScheduler<Scheduler>(state);
+    const int64_t count = state.range(1);
+    for (auto _ : state) {
+        std::vector<tpl::Task<int>> tasks;
+        tasks.reserve(static_cast<size_t>(count));
+        for (int64_t i = 0; i < count; ++i) {
+            tasks.push_back(tpl::MakeTask([i]() { return static_cast<int>(i); }, scheduler.get()));
+        }
+        auto all = tpl::WhenAll(tasks);
+        tpl::StartAll(tasks);
+        benchmark::DoNotOptimize(all.GetFuture().GetValue().size());
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+
+/// The second argument is the number of the nested tasks, each of which is unwrapped in the next step
+template <class Scheduler>
+void BM_UnwrapChain(benchmark::State& state)
+{
+    auto holder = MakeScheduler<Scheduler>(state);
+    auto* scheduler = holder.get();
+    const int64_t depth = state.range(1);
+    for (auto _ : state) {
+        auto last = tpl::MakeTask([]() { return 0; }, scheduler);
+        last.Start();
+        for (int64_t i = 0; i < depth; ++i) {
+            last = last.Then([scheduler](const tpl::Task<int>& parent) {
+                           auto inner = tpl::MakeTask([value = parent.GetFuture().GetValue()]() { return value + 1; }, scheduler);
+                           inner.Start();
+                           return inner;
+                       })
+                       .Unwrap(scheduler);
+        }
+        benchmark::DoNotOptimize(last.GetFuture().GetValue());
+    }
+    state.SetItemsProcessed(state.iterations() * depth);
+}
+
+/// The second argument is the number of the producer threads, each schedules kFunctorsPerProducer functors
+template <class Scheduler>
+void BM_ContendedSchedule(benchmark::State& state)
+{
+    constexpr int64_t kFunctorsPerProducer = 10000;
+    auto scheduler = MakeScheduler<Scheduler>(state);
+    const int64_t producerCount = state.range(1);
+    for (auto _ : state) {
+        std::atomic<int64_t> doneCount { 0 };
+        std::vector<std::thread> producers;
+        for (int64_t p = 0; p < producerCount; ++p) {
+            producers.emplace_back([&scheduler, &doneCount]() {
+                for (int64_t i = 0; i < kFunctorsPerProducer; ++i) {
+                    scheduler->Schedule(tpl::UniqueFunction<void()>([&doneCount]() { doneCount.fetch_add(1, std::memory_order_relaxed); }));
+                }
+            });
+        }
+        for (auto& producer : producers) {
+            producer.join();
+        }
+        while (doneCount.load(std::memory_order_relaxed) != producerCount * kFunctorsPerProducer) {
+            std::this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * producerCount * kFunctorsPerProducer);
+}
+
+/// The second argument is the number of the listeners, which are registered by the workers concurrently, then the value is set
+template <class Scheduler>
+void BM_FutureListeners(benchmark::State& state)
+{
+    auto scheduler = MakeScheduler<Scheduler>(state);
+    const int64_t listenerCount = state.range(1);
+    for (auto _ : state) {
+        auto source = tpl::MakeTask([]() { return 1; }, scheduler.get());
+        std::atomic<int64_t> calledCount { 0 };
+        std::vector<tpl::Task<void>> registrations;
+        registrations.reserve(static_cast<size_t>(listenerCount));
+        for (int64_t i = 0; i < listenerCount; ++i) {
+            registrations.push_back(tpl::MakeTask(
+                [source, &calledCount]() {
+                    source.GetFuture().InvokeOnValueAvailable([&calledCount](const int&) { calledCount.fetch_add(1, std::memory_order_relaxed); });
+                },
+                scheduler.get()));
+        }
+        auto registered = tpl::WhenAll(registrations);
+        tpl::StartAll(registrations);
+        registered.GetFuture().Wait();
+        source.Start();
+        source.GetFuture().Wait();
+        while (calledCount.load(std::memory_order_relaxed) != listenerCount) {
+            std::this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * listenerCount);
+}
+
+void ThreadArgs(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->ArgName("threads");
+    for (int64_t threads = 1; threads <= static_cast<int64_t>(std::max(1u, std::thread::hardware_concurrency())); threads *= 2) {
+        benchmark->Arg(threads);
+    }
+}
+
+template <int64_t... Values>
+void ThreadAndSizeArgs(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->ArgNames({ "threads", "n" });
+    for (int64_t threads = 1; threads <= static_cast<int64_t>(std::max(1u, std::thread::hardware_concurrency())); threads *= 2) {
+        for (int64_t value : { Values... }) {
+            benchmark->Args({ threads, value });
+        }
+    }
+}
+
+}
+
+#define TPL_BENCHMARK(name, args)                                                          \
+    BENCHMARK_TEMPLATE(name, tpl::ParallelTaskScheduler)->Apply(args)->UseRealTime();      \
+    BENCHMARK_TEMPLATE(name, tpl::WorkStealingTaskScheduler)->Apply(args)->UseRealTime()
+
+TPL_BENCHMARK(BM_SpawnWait, ThreadArgs);
+TPL_BENCHMARK(BM_ThenChain, (ThreadAndSizeArgs<1, 10, 100, 1000>));
+TPL_BENCHMARK(BM_FanOutFanIn, (ThreadAndSizeArgs<1000, 1000000>));
+TPL_BENCHMARK(BM_UnwrapChain, (ThreadAndSizeArgs<1, 10, 100>));
+TPL_BENCHMARK(BM_ContendedSchedule, (ThreadAndSizeArgs<1, 4, 16>));
+TPL_BENCHMARK(BM_FutureListeners, (ThreadAndSizeArgs<16, 1024>));
+
+BENCHMARK_MAIN();
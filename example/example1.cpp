@@ -6,6 +6,7 @@
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <queue>
 #include <thread>
 
 int64_t CurrentTime()
@@ -0,0 +1,58 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+#include <TPL/TPL.h>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+std::mutex gLoggerMutex;
+
+#define LOG(x)                                                                \
+    do {                                                                      \
+        std::unique_lock<std::mutex> lck(gLoggerMutex);                       \
+        std::cout << std::this_thread::get_id() << ": " << x << std::endl;    \
+    } while (false)
+
+void SleepFor(int millis)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+}
+
+tpl::Task<std::string> Request(tpl::ITaskScheduler& scheduler, int id)
+{
+    // An ordinary task, awaited by the coroutines below
+    return tpl::MakeTaskAndStart(
+        [id]() {
+            SleepFor(100);
+            return "Response" + std::to_string(id);
+        },
+        &scheduler);
+}
+
+// The coroutine runs in the scheduler passed as its first ITaskScheduler argument
+tpl::Task<size_t> Download(tpl::ITaskScheduler& scheduler)
+{
+    LOG("Download started");
+    std::string first = co_await Request(scheduler, 1);
+    LOG("Got " << first);
+    std::string second = co_await Request(scheduler, 2);
+    LOG("Got " << second);
+    co_return first.size() + second.size();
+}
+
+tpl::Task<void> Run(tpl::ITaskScheduler* scheduler)
+{
+    auto length = co_await Download(*scheduler);
+    LOG("Downloaded " << length << " bytes");
+}
+
+int main()
+{
+    tpl::WorkStealingTaskScheduler scheduler(4);
+    auto task = Run(&scheduler);
+    task.GetFuture().Wait();
+    LOG("End");
+    return 0;
+}
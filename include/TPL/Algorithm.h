@@ -0,0 +1,322 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/Task.h"
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace tpl {
+
+namespace internal {
+
+    /// Splits [begin, end) lazily, in the style of TBB's auto_partitioner:
+    /// a range is split into 2^depth pieces at most, where the initial depth makes about 4 pieces per worker,
+    /// and a piece which is executed in a thread other than the one spawned it (i.e. it is stolen, the workers are starving)
+    /// may split kStolenExtraDepth levels deeper, so there are at most about 16 pieces per worker however often the pieces are stolen.
+    /// A piece is never split below the grain size, nor below 1 / 16 of the share of a worker.
+    /// The body is invoked as body(subBegin, subEnd) concurrently, and finalizer(exception) is invoked once all the pieces are done,
+    /// where exception is the first exception thrown by the body, or nullptr. The pieces not started yet are skipped once the body throws.
+    template <class Body, class Finalizer>
+    class AdaptiveRangeExecutor final : public RefCounted {
+    public:
+        static constexpr int kStolenExtraDepth = 2;
+
+        template <class B, class F>
+        AdaptiveRangeExecutor(B&& body, F&& finalizer, ITaskScheduler& scheduler, size_t grainSize)
+            : body_ { std::forward<B>(body) }
+            , finalizer_ { std::forward<F>(finalizer) }
+            , scheduler_ { &scheduler }
+            , grainSize_ { std::max<size_t>(grainSize, 1) }
+        {
+        }
+
+        void Start(size_t begin, size_t end)
+        {
+            const size_t concurrency = std::max<size_t>(scheduler_->GetConcurrency(), 1);
+            initialDepth_ = 2;
+            for (size_t n = 1; n < concurrency; n *= 2) {
+                ++initialDepth_;
+            }
+            constexpr size_t kMaxPiecesPerWorker = size_t(4) << kStolenExtraDepth;
+            grainSize_ = std::max(grainSize_, (end - begin) / (concurrency * kMaxPiecesPerWorker));
+            Spawn(begin, end, 0, initialDepth_, std::thread::id {});
+        }
+
+    private:
+        /// The piece is split while depth < maxDepth, i.e. depth is the number of the splits made to get the piece
+        void Spawn(size_t begin, size_t end, int depth, int maxDepth, std::thread::id spawner)
+        {
+            pendingCount_.fetch_add(1, std::memory_order_relaxed);
+            scheduler_->Schedule(UniqueFunction<void()>([self = RefCntAutoPtr(this), begin, end, depth, maxDepth, spawner]() {
+                self->Execute(begin, end, depth, maxDepth, spawner);
+            }));
+        }
+
+        void Execute(size_t begin, size_t end, int depth, int maxDepth, std::thread::id spawner)
+        {
+            auto current = std::this_thread::get_id();
+            if (spawner != std::thread::id {} && spawner != current) {
+                // Raised to a bound instead of being added to, otherwise the pieces stolen again and again are split down to the grain
+                maxDepth = std::max(maxDepth, initialDepth_ + kStolenExtraDepth);
+            }
+            while (end - begin > grainSize_ && depth < maxDepth) {
+                size_t middle = begin + (end - begin) / 2;
+                ++depth;
+                Spawn(middle, end, depth, maxDepth, current);
+                end = middle;
+            }
+            if (!hasException_.load(std::memory_order_relaxed)) {
+                try {
+                    body_(begin, end);
+                } catch (...) {
+                    if (!hasException_.exchange(true, std::memory_order_relaxed)) {
+                        exception_ = std::current_exception();
+                    }
+                }
+            }
+            if (pendingCount_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                finalizer_(std::move(exception_));
+            }
+        }
+
+    private:
+        Body body_;
+        Finalizer finalizer_;
+        ITaskScheduler* scheduler_;
+        size_t grainSize_;
+        int initialDepth_ { 0 };
+        std::atomic<size_t> pendingCount_ { 0 };
+        std::atomic_bool hasException_ { false };
+        std::exception_ptr exception_ { nullptr };
+    };
+
+    template <class Body, class Finalizer>
+    inline void ExecuteAdaptively(size_t count, Body&& body, Finalizer&& finalizer, ITaskScheduler& scheduler, size_t grainSize)
+    {
+        using ExecutorType = AdaptiveRangeExecutor<std::decay_t<Body>, std::decay_t<Finalizer>>;
+        RefCntAutoPtr<ExecutorType> executor(new ExecutorType(std::forward<Body>(body), std::forward<Finalizer>(finalizer), scheduler, grainSize));
+        executor->Start(0, count);
+    }
+
+    /// TaskCanceledException completes the future as canceled, the other exceptions are stored in the future
+    template <class T>
+    inline void SetFailed(Future<T>& future, std::exception_ptr exception)
+    {
+        try {
+            std::rethrow_exception(exception);
+        } catch (const TaskCanceledException&) {
+            future.SetCanceled();
+        } catch (...) {
+            future.SetException(std::current_exception());
+        }
+    }
+
+    inline ITaskScheduler& ResolveScheduler(ITaskScheduler* scheduler)
+    {
+        if (scheduler == nullptr) {
+            scheduler = gDefaultTaskScheduler;
+            assert(scheduler != nullptr); // "Did you forget to specify a scheduler?"
+        }
+        return *scheduler;
+    }
+
+    /// Integers are passed as is, iterators are dereferenced
+    template <class Iterator>
+    inline decltype(auto) ElementAt(Iterator first, size_t i)
+    {
+        if constexpr (std::is_integral_v<Iterator>) {
+            return static_cast<Iterator>(first + static_cast<Iterator>(i));
+        } else {
+            return *(first + static_cast<typename std::iterator_traits<Iterator>::difference_type>(i));
+        }
+    }
+
+    template <class Iterator>
+    inline size_t Distance(Iterator first, Iterator last)
+    {
+        if constexpr (std::is_integral_v<Iterator>) {
+            return last > first ? static_cast<size_t>(last - first) : 0;
+        } else {
+            return static_cast<size_t>(std::distance(first, last));
+        }
+    }
+
+}
+
+/// Invokes functor(i) for each i in [first, last) if Iterator is an integer type, or functor(*it) for each random access iterator in [first, last).
+/// The returned task is ready once all the invocations are done.
+/// The range is never split into pieces smaller than grainSize, the pieces are at least about 1 / 16 of the share of a worker anyway.
+template <class Iterator, class Functor>
+inline Task<void> ParallelFor(Iterator first, Iterator last, Functor&& functor, ITaskScheduler* scheduler, size_t grainSize = 1)
+{
+    auto& sched = internal::ResolveScheduler(scheduler);
+    auto result = internal::MakeProxyTask<void>(sched);
+    size_t count = internal::Distance(first, last);
+    if (count == 0) {
+        const_cast<Future<void>&>(result.GetFuture()).SetValue();
+        return result;
+    }
+    internal::ExecuteAdaptively(
+        count,
+        [first, functor = std::forward<Functor>(functor)](size_t begin, size_t end) mutable {
+            for (size_t i = begin; i < end; ++i) {
+                functor(internal::ElementAt(first, i));
+            }
+        },
+        [result](std::exception_ptr exception) {
+            auto& future = const_cast<Future<void>&>(result.GetFuture());
+            if (exception != nullptr) {
+                internal::SetFailed(future, std::move(exception));
+            } else {
+                future.SetValue();
+            }
+        },
+        sched, grainSize);
+    return result;
+}
+
+/// Reduces [first, last) with init and an associative binary operator, which is not required to be commutative.
+template <class Iterator, class T, class BinaryOp>
+inline Task<T> ParallelReduce(Iterator first, Iterator last, T init, BinaryOp&& op, ITaskScheduler* scheduler, size_t grainSize = 1)
+{
+    auto& sched = internal::ResolveScheduler(scheduler);
+    auto result = internal::MakeProxyTask<T>(sched);
+    size_t count = internal::Distance(first, last);
+    if (count == 0) {
+        const_cast<Future<T>&>(result.GetFuture()).SetValue(std::move(init));
+        return result;
+    }
+
+    struct PartialResults {
+        std::mutex mutex {};
+        std::vector<std::pair<size_t, T>> values {};
+    };
+    auto partials = std::make_shared<PartialResults>();
+    auto sharedOp = std::make_shared<std::decay_t<BinaryOp>>(std::forward<BinaryOp>(op));
+
+    internal::ExecuteAdaptively(
+        count,
+        [first, partials, sharedOp](size_t begin, size_t end) {
+            T value(internal::ElementAt(first, begin));
+            for (size_t i = begin + 1; i < end; ++i) {
+                value = (*sharedOp)(std::move(value), internal::ElementAt(first, i));
+            }
+            std::unique_lock<std::mutex> lck(partials->mutex);
+            partials->values.emplace_back(begin, std::move(value));
+        },
+        [result, partials, sharedOp, init = std::move(init)](std::exception_ptr exception) mutable {
+            auto& future = const_cast<Future<T>&>(result.GetFuture());
+            if (exception != nullptr) {
+                internal::SetFailed(future, std::move(exception));
+                return;
+            }
+            std::optional<T> value;
+            try {
+                // The pieces may be finished in any order
+                auto& values = partials->values;
+                std::sort(values.begin(), values.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+                value.emplace(std::move(init));
+                for (auto& partial : values) {
+                    value = (*sharedOp)(std::move(*value), std::move(partial.second));
+                }
+            } catch (...) {
+                internal::SetFailed(future, std::current_exception());
+                return;
+            }
+            future.SetValue(std::move(*value));
+        },
+        sched, grainSize);
+    return result;
+}
+
+/// Writes op(*it) to the corresponding position of dest for each it in [first, last).
+template <class InputIterator, class OutputIterator, class UnaryOp>
+inline Task<void> ParallelTransform(InputIterator first, InputIterator last, OutputIterator dest, UnaryOp&& op, ITaskScheduler* scheduler, size_t grainSize = 1)
+{
+    auto& sched = internal::ResolveScheduler(scheduler);
+    auto result = internal::MakeProxyTask<void>(sched);
+    size_t count = internal::Distance(first, last);
+    if (count == 0) {
+        const_cast<Future<void>&>(result.GetFuture()).SetValue();
+        return result;
+    }
+    internal::ExecuteAdaptively(
+        count,
+        [first, dest, op = std::forward<UnaryOp>(op)](size_t begin, size_t end) mutable {
+            using Difference = typename std::iterator_traits<OutputIterator>::difference_type;
+            for (size_t i = begin; i < end; ++i) {
+                *(dest + static_cast<Difference>(i)) = op(internal::ElementAt(first, i));
+            }
+        },
+        [result](std::exception_ptr exception) {
+            auto& future = const_cast<Future<void>&>(result.GetFuture());
+            if (exception != nullptr) {
+                internal::SetFailed(future, std::move(exception));
+            } else {
+                future.SetValue();
+            }
+        },
+        sched, grainSize);
+    return result;
+}
+
+/// Sorts [first, last): the range is divided into about 2 pieces per worker, which are sorted simultaneously,
+/// then the sorted pieces are merged pairwise, each merge is a task that depends on the two tasks producing its halves.
+template <class RandomIt, class Compare = std::less<>>
+inline Task<void> ParallelSort(RandomIt first, RandomIt last, ITaskScheduler* scheduler, Compare comp = Compare {}, size_t grainSize = 2048)
+{
+    auto& sched = internal::ResolveScheduler(scheduler);
+    size_t count = static_cast<size_t>(std::distance(first, last));
+    size_t numPieces = 1;
+    while (numPieces < 2 * sched.GetConcurrency() && count / (numPieces * 2) >= std::max<size_t>(grainSize, 1)) {
+        numPieces *= 2;
+    }
+
+    auto boundary = [first, count, numPieces](size_t i) {
+        return first + static_cast<typename std::iterator_traits<RandomIt>::difference_type>(count * i / numPieces);
+    };
+
+    struct Piece {
+        Task<void> task;
+        size_t begin;
+        size_t end;
+    };
+    std::vector<Piece> pieces;
+    std::vector<Task<void>> leaves;
+    pieces.reserve(numPieces);
+    leaves.reserve(numPieces);
+    for (size_t i = 0; i < numPieces; ++i) {
+        auto task = MakeTask([b = boundary(i), e = boundary(i + 1), comp]() { std::sort(b, e, comp); }, &sched);
+        pieces.push_back(Piece { task, i, i + 1 });
+        leaves.push_back(task);
+    }
+    while (pieces.size() > 1) {
+        std::vector<Piece> merged;
+        merged.reserve(pieces.size() / 2);
+        for (size_t i = 0; i + 1 < pieces.size(); i += 2) {
+            auto& left = pieces[i];
+            auto& right = pieces[i + 1];
+            auto task = MakeTask(
+                [b = boundary(left.begin), m = boundary(right.begin), e = boundary(right.end), comp](const Task<void>&, const Task<void>&) {
+                    std::inplace_merge(b, m, e, comp);
+                },
+                &sched, left.task, right.task);
+            merged.push_back(Piece { task, left.begin, right.end });
+        }
+        pieces = std::move(merged);
+    }
+    StartAll(leaves);
+    return pieces.front().task;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/Future.h"
+#include "TPL/RefCntAutoPtr.h"
+#include "TPL/RefCounted.h"
+#include <atomic>
+
+namespace tpl {
+
+namespace internal {
+
+    struct CancellationState : RefCounted {
+        std::atomic_bool isCanceled { false };
+    };
+
+}
+
+/// A copyable handle to observe the cancellation requested by a CancellationSource.
+/// A default constructed token can never be canceled.
+class CancellationToken {
+public:
+    CancellationToken() = default;
+
+    /// The check is one relaxed load, it's cheap enough to be called in hot loops
+    bool IsCancellationRequested() const
+    {
+        return state_ != nullptr && state_->isCanceled.load(std::memory_order_relaxed);
+    }
+
+    /// Throws TaskCanceledException if the cancellation is requested, the task throwing it is completed as canceled
+    void ThrowIfCancellationRequested() const
+    {
+        if (IsCancellationRequested()) {
+            throw TaskCanceledException();
+        }
+    }
+
+    bool CanBeCanceled() const { return state_ != nullptr; }
+
+private:
+    explicit CancellationToken(internal::CancellationState* state)
+        : state_ { state }
+    {
+    }
+
+    RefCntAutoPtr<internal::CancellationState> state_ { nullptr };
+
+    friend class CancellationSource;
+};
+
+/// Requests the cancellation of all the tasks created with its tokens.
+/// The tasks not started yet will be completed as canceled without being run, the running tasks may check the token cooperatively.
+class CancellationSource {
+public:
+    CancellationSource()
+        : state_ { new internal::CancellationState() }
+    {
+    }
+
+    CancellationToken GetToken() const { return CancellationToken(state_.Get()); }
+
+    void Cancel() { state_->isCanceled.store(true, std::memory_order_relaxed); }
+
+    bool IsCancellationRequested() const { return state_->isCanceled.load(std::memory_order_relaxed); }
+
+private:
+    RefCntAutoPtr<internal::CancellationState> state_;
+};
+
+}
@@ -0,0 +1,392 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/Algorithm.h"
+#include "TPL/Cancellation.h"
+#include "TPL/RefCntAutoPtr.h"
+#include "TPL/RefCounted.h"
+#include "TPL/Task.h"
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace tpl {
+
+/// Thrown by the task returned by Channel::Send if the channel is closed before the value is accepted
+class ChannelClosedException : public std::exception {
+public:
+    const char* what() const noexcept override { return "The channel is closed"; }
+};
+
+namespace internal {
+
+    /// The shared state of a channel, guarded by one mutex.
+    /// The parked senders are only non-empty if the buffer is full, and the parked receivers only if the buffer is empty,
+    /// so a value is either buffered, or handed from a sender to a receiver directly.
+    /// The futures are completed after the mutex is unlocked, since their listeners may schedule (or run) the continuations.
+    /// A parked receiver whose token is canceled is withdrawn (and canceled) once it's met at the front of the receivers,
+    /// i.e. by the next value handed over, the next receiver parked, or Close, so no value is handed to an abandoned receiver.
+    template <class T>
+    class ChannelState final : public RefCounted {
+    public:
+        ChannelState(size_t capacity, ITaskScheduler& scheduler)
+            : capacity_ { capacity }
+            , scheduler_ { &scheduler }
+        {
+        }
+
+        template <class U>
+        bool TrySend(U&& value)
+        {
+            PendingReceiver receiver {};
+            std::vector<PendingReceiver> withdrawn;
+            std::unique_lock<std::mutex> lck(mutex_);
+            if (isClosed_) {
+                return false;
+            }
+            if (PopReceiverLocked(receiver, withdrawn)) {
+                lck.unlock();
+                CancelReceivers(withdrawn);
+                HandOver(receiver, std::forward<U>(value));
+                return true;
+            }
+            bool isBuffered = buffer_.size() < capacity_;
+            if (isBuffered) {
+                buffer_.emplace_back(std::forward<U>(value));
+            }
+            lck.unlock();
+            CancelReceivers(withdrawn);
+            return isBuffered;
+        }
+
+        Task<void> Send(T&& value)
+        {
+            PendingReceiver receiver {};
+            std::vector<PendingReceiver> withdrawn;
+            std::unique_lock<std::mutex> lck(mutex_);
+            if (isClosed_) {
+                lck.unlock();
+                return MakeFailedSend();
+            }
+            if (PopReceiverLocked(receiver, withdrawn)) {
+                lck.unlock();
+                CancelReceivers(withdrawn);
+                HandOver(receiver, std::move(value));
+                return MakeReadySend();
+            }
+            if (buffer_.size() < capacity_) {
+                buffer_.push_back(std::move(value));
+                lck.unlock();
+                CancelReceivers(withdrawn);
+                return MakeReadySend();
+            }
+            auto task = MakeProxyTask<void>(*scheduler_);
+            senders_.push_back(PendingSender { std::move(value), task });
+            lck.unlock();
+            CancelReceivers(withdrawn);
+            return task;
+        }
+
+        /// Moves at most maxCount values to out, returns the number of the values received
+        size_t TryReceive(T* out, size_t maxCount)
+        {
+            std::vector<Task<void>> acceptedSenders;
+            size_t count;
+            {
+                std::unique_lock<std::mutex> lck(mutex_);
+                count = TakeLocked(maxCount, [out](T&& value, size_t i) { out[i] = std::move(value); }, acceptedSenders);
+            }
+            CompleteSenders(acceptedSenders);
+            return count;
+        }
+
+        Task<std::optional<T>> Receive(const CancellationToken& token)
+        {
+            if (token.IsCancellationRequested()) {
+                return MakeCanceled<std::optional<T>>();
+            }
+            std::vector<Task<void>> acceptedSenders;
+            std::optional<T> value;
+            {
+                std::unique_lock<std::mutex> lck(mutex_);
+                if (TakeLocked(1, [&value](T&& v, size_t) { value.emplace(std::move(v)); }, acceptedSenders) == 0 && !isClosed_) {
+                    auto task = MakeProxyTask<std::optional<T>>(*scheduler_);
+                    Park(lck, PendingReceiver { task, {}, token });
+                    return task;
+                }
+            }
+            CompleteSenders(acceptedSenders);
+            return MakeReady(std::move(value));
+        }
+
+        Task<std::vector<T>> ReceiveMany(size_t maxCount, const CancellationToken& token)
+        {
+            assert(maxCount > 0);
+            if (token.IsCancellationRequested()) {
+                return MakeCanceled<std::vector<T>>();
+            }
+            std::vector<Task<void>> acceptedSenders;
+            std::vector<T> values;
+            {
+                std::unique_lock<std::mutex> lck(mutex_);
+                auto append = [&values](T&& v, size_t) { values.push_back(std::move(v)); };
+                if (TakeLocked(maxCount, append, acceptedSenders) == 0 && !isClosed_) {
+                    auto task = MakeProxyTask<std::vector<T>>(*scheduler_);
+                    Park(lck, PendingReceiver { {}, task, token });
+                    return task;
+                }
+            }
+            CompleteSenders(acceptedSenders);
+            return MakeReady(std::move(values));
+        }
+
+        void Close()
+        {
+            std::deque<PendingSender> senders;
+            std::deque<PendingReceiver> receivers;
+            {
+                std::unique_lock<std::mutex> lck(mutex_);
+                if (isClosed_) {
+                    return;
+                }
+                isClosed_ = true;
+                senders.swap(senders_);
+                receivers.swap(receivers_);
+            }
+            for (auto& sender : senders) {
+                SetFuture(sender.task).SetException(std::make_exception_ptr(ChannelClosedException()));
+            }
+            for (auto& receiver : receivers) {
+                if (receiver.token.IsCancellationRequested()) {
+                    CancelReceiver(receiver);
+                } else if (receiver.one.Valid()) {
+                    SetFuture(receiver.one).SetValue(std::nullopt);
+                } else {
+                    SetFuture(receiver.many).SetValue(std::vector<T> {});
+                }
+            }
+        }
+
+        bool IsClosed() const
+        {
+            std::unique_lock<std::mutex> lck(mutex_);
+            return isClosed_;
+        }
+
+        size_t GetSize() const
+        {
+            std::unique_lock<std::mutex> lck(mutex_);
+            return buffer_.size();
+        }
+
+        size_t GetCapacity() const { return capacity_; }
+
+    private:
+        struct PendingSender {
+            T value;
+            Task<void> task;
+        };
+
+        // One of the tasks is valid, depending on Receive or ReceiveMany, it's given the first value sent after parking
+        struct PendingReceiver {
+            Task<std::optional<T>> one;
+            Task<std::vector<T>> many;
+            CancellationToken token;
+        };
+
+        template <class U>
+        static Future<U>& SetFuture(const Task<U>& task) { return const_cast<Future<U>&>(task.GetFuture()); }
+
+        /// Pops the first parked receiver whose token is not canceled, the canceled ones before it are moved to withdrawn,
+        /// to be canceled after unlocking. Returns false if there is no such receiver
+        bool PopReceiverLocked(PendingReceiver& receiver, std::vector<PendingReceiver>& withdrawn)
+        {
+            while (!receivers_.empty()) {
+                auto& front = receivers_.front();
+                if (!front.token.IsCancellationRequested()) {
+                    receiver = std::move(front);
+                    receivers_.pop_front();
+                    return true;
+                }
+                withdrawn.push_back(std::move(front));
+                receivers_.pop_front();
+            }
+            return false;
+        }
+
+        /// Parks the receiver behind the others, after withdrawing the canceled ones at the front. Unlocks lck
+        void Park(std::unique_lock<std::mutex>& lck, PendingReceiver receiver)
+        {
+            std::vector<PendingReceiver> withdrawn;
+            while (!receivers_.empty() && receivers_.front().token.IsCancellationRequested()) {
+                withdrawn.push_back(std::move(receivers_.front()));
+                receivers_.pop_front();
+            }
+            receivers_.push_back(std::move(receiver));
+            lck.unlock();
+            CancelReceivers(withdrawn);
+        }
+
+        /// Gives the value to a receiver popped by PopReceiverLocked, the buffer is empty here.
+        /// A parked ReceiveMany gets just this value, the values sent later are not held back to fill its batch
+        template <class U>
+        static void HandOver(PendingReceiver& receiver, U&& value)
+        {
+            if (receiver.one.Valid()) {
+                SetFuture(receiver.one).SetValue(std::optional<T>(std::forward<U>(value)));
+            } else {
+                std::vector<T> values;
+                values.emplace_back(std::forward<U>(value));
+                SetFuture(receiver.many).SetValue(std::move(values));
+            }
+        }
+
+        /// Takes at most maxCount values from the buffer then from the parked senders, and refills the buffer with the rest of the senders.
+        /// The accepted senders are collected to be completed after unlocking
+        template <class Consumer>
+        size_t TakeLocked(size_t maxCount, Consumer&& consumer, std::vector<Task<void>>& acceptedSenders)
+        {
+            size_t count = 0;
+            while (count < maxCount && !buffer_.empty()) {
+                consumer(std::move(buffer_.front()), count++);
+                buffer_.pop_front();
+            }
+            while (count < maxCount && !senders_.empty()) {
+                consumer(std::move(senders_.front().value), count++);
+                acceptedSenders.push_back(std::move(senders_.front().task));
+                senders_.pop_front();
+            }
+            while (buffer_.size() < capacity_ && !senders_.empty()) {
+                buffer_.push_back(std::move(senders_.front().value));
+                acceptedSenders.push_back(std::move(senders_.front().task));
+                senders_.pop_front();
+            }
+            return count;
+        }
+
+        static void CancelReceiver(PendingReceiver& receiver)
+        {
+            if (receiver.one.Valid()) {
+                SetFuture(receiver.one).SetCanceled();
+            } else {
+                SetFuture(receiver.many).SetCanceled();
+            }
+        }
+
+        static void CancelReceivers(std::vector<PendingReceiver>& receivers)
+        {
+            for (auto& receiver : receivers) {
+                CancelReceiver(receiver);
+            }
+        }
+
+        static void CompleteSenders(std::vector<Task<void>>& senders)
+        {
+            for (auto& sender : senders) {
+                SetFuture(sender).SetValue();
+            }
+        }
+
+        Task<void> MakeReadySend()
+        {
+            auto task = MakeProxyTask<void>(*scheduler_);
+            SetFuture(task).SetValue();
+            return task;
+        }
+
+        Task<void> MakeFailedSend()
+        {
+            auto task = MakeProxyTask<void>(*scheduler_);
+            SetFuture(task).SetException(std::make_exception_ptr(ChannelClosedException()));
+            return task;
+        }
+
+        template <class U>
+        Task<U> MakeCanceled()
+        {
+            auto task = MakeProxyTask<U>(*scheduler_);
+            SetFuture(task).SetCanceled();
+            return task;
+        }
+
+        template <class U>
+        Task<U> MakeReady(U value)
+        {
+            auto task = MakeProxyTask<U>(*scheduler_);
+            SetFuture(task).SetValue(std::move(value));
+            return task;
+        }
+
+    private:
+        mutable std::mutex mutex_ {};
+        std::deque<T> buffer_ {};
+        std::deque<PendingSender> senders_ {};
+        std::deque<PendingReceiver> receivers_ {};
+        size_t capacity_;
+        ITaskScheduler* scheduler_;
+        bool isClosed_ { false };
+    };
+
+}
+
+/// A bounded multi-producer multi-consumer channel of values between tasks, it's a copyable handle of the shared state.
+/// Send returns a task which is ready once the value is accepted, so a fast producer awaiting it is throttled by the consumers,
+/// and Receive / ReceiveMany return tasks which are ready once there are values, so a consumer is only continued with data available,
+/// and ReceiveMany takes all the buffered values (up to maxCount) at once, to cut the wake-ups of a busy stream.
+/// The returned tasks are proxy tasks of the scheduler of the channel, their continuations run there.
+/// A channel with capacity 0 is a rendezvous: each value is handed from a sender to a receiver directly.
+template <class T>
+class Channel {
+public:
+    /// If scheduler == nullptr, the default scheduler will be used
+    explicit Channel(size_t capacity, ITaskScheduler* scheduler = nullptr)
+        : state_ { new internal::ChannelState<T>(capacity, internal::ResolveScheduler(scheduler)) }
+    {
+    }
+
+    /// Never blocks, returns false without consuming the value if the channel is full or closed
+    template <class U>
+    bool TrySend(U&& value) { return state_->TrySend(std::forward<U>(value)); }
+
+    /// Returns a task which is ready once the value is buffered or received, or faulted with ChannelClosedException if the channel is closed first
+    Task<void> Send(T value) { return state_->Send(std::move(value)); }
+
+    /// Never blocks, returns false if there is no value
+    bool TryReceive(T& value) { return state_->TryReceive(&value, 1) == 1; }
+
+    /// Never blocks, moves at most maxCount values to out, returns the number of the values received
+    size_t TryReceiveMany(T* out, size_t maxCount) { return state_->TryReceive(out, maxCount); }
+
+    /// Returns a task of the next value, or of std::nullopt if the channel is closed and drained.
+    /// If token is canceled, the task is canceled instead, and a parked one is withdrawn without taking a value (see internal::ChannelState),
+    /// so a consumer that gives up waiting (e.g. on a timeout) should cancel its token rather than just drop the task
+    Task<std::optional<T>> Receive(const CancellationToken& token = {}) { return state_->Receive(token); }
+
+    /// Returns a task of 1 to maxCount values, or of an empty vector if the channel is closed and drained.
+    /// The batch is the values buffered (or parked by the senders) when it's called, if there is none,
+    /// it parks and is completed with only the first value sent, the later ones are left for the next call.
+    /// The token is honored as in Receive
+    Task<std::vector<T>> ReceiveMany(size_t maxCount, const CancellationToken& token = {}) { return state_->ReceiveMany(maxCount, token); }
+
+    /// The buffered values can still be received, the parked senders are faulted with ChannelClosedException,
+    /// and the parked receivers get std::nullopt / an empty vector, or are canceled if their tokens are canceled
+    void Close() { state_->Close(); }
+
+    bool IsClosed() const { return state_->IsClosed(); }
+
+    /// The number of the buffered values
+    size_t GetSize() const { return state_->GetSize(); }
+
+    size_t GetCapacity() const { return state_->GetCapacity(); }
+
+private:
+    RefCntAutoPtr<internal::ChannelState<T>> state_;
+};
+
+}
@@ -0,0 +1,248 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && __has_include(<coroutine>)
+
+#include "TPL/Task.h"
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+#define TPL_HAS_COROUTINE 1
+
+namespace tpl {
+
+namespace internal {
+
+    /// Finds the first argument of a coroutine that is an ITaskScheduler& or an ITaskScheduler*
+    inline ITaskScheduler* FindScheduler()
+    {
+        return nullptr;
+    }
+
+    template <class First, class... Rest>
+    inline ITaskScheduler* FindScheduler(First& first, Rest&... rest)
+    {
+        using Type = std::remove_cv_t<First>;
+        if constexpr (std::is_convertible_v<Type*, ITaskScheduler*>) {
+            return &first;
+        } else if constexpr (std::is_convertible_v<Type, ITaskScheduler*> && std::is_pointer_v<Type>) {
+            return first != nullptr ? static_cast<ITaskScheduler*>(first) : FindScheduler(rest...);
+        } else {
+            return FindScheduler(rest...);
+        }
+    }
+
+    /// Resumes handle in the current thread if it is a worker of scheduler (or scheduler == nullptr, i.e. the awaiting coroutine doesn't return a Task),
+    /// otherwise schedules it to scheduler. The inline resumptions nest no deeper than kMaxInlineContinuationDepth,
+    /// the deeper ones go to the default scheduler if scheduler == nullptr, so a long chain of ready tasks can't overflow the stack.
+    inline void ResumeOn(std::coroutine_handle<> handle, ITaskScheduler* scheduler)
+    {
+        ITaskScheduler* target = scheduler != nullptr ? scheduler : gDefaultTaskScheduler;
+        bool canInline = scheduler == nullptr || GetCurrentTaskScheduler() == scheduler;
+        // Without any scheduler to go, there is no choice but resuming inline
+        if (target == nullptr || (canInline && tInlineContinuationDepth < kMaxInlineContinuationDepth)) {
+            ++tInlineContinuationDepth;
+            handle.resume();
+            --tInlineContinuationDepth;
+        } else {
+            target->Schedule(UniqueFunction<void()>([handle]() { handle.resume(); }), ScheduleOptions { TaskPriority::kNormal, true });
+        }
+    }
+
+    /// The body of a coroutine returning a Task is always started in the scheduler.
+    /// If a bounded scheduler rejects it, the returned task is faulted with TaskRejectedException and the frame is destroyed,
+    /// like a rejected Task::Start, instead of throwing to the caller
+    struct ScheduleAwaiter {
+        bool await_ready() const noexcept { return false; }
+
+        template <class Promise>
+        void await_suspend(std::coroutine_handle<Promise> handle) const
+        {
+            try {
+                scheduler->Schedule(UniqueFunction<void()>([handle]() { handle.resume(); }));
+            } catch (const TaskRejectedException&) {
+                handle.promise().unhandled_exception();
+                // This awaiter is in the frame, it's not accessed anymore
+                handle.destroy();
+            }
+        }
+
+        void await_resume() const noexcept { }
+
+        ITaskScheduler* scheduler;
+    };
+
+    class TaskPromiseBase {
+    public:
+        template <class... Args>
+        explicit TaskPromiseBase(Args&... args)
+            : scheduler_ { FindScheduler(args...) }
+        {
+            if (scheduler_ == nullptr) {
+                scheduler_ = gDefaultTaskScheduler;
+                assert(scheduler_ != nullptr); // "Did you forget to specify a scheduler?"
+            }
+        }
+
+        ITaskScheduler* GetScheduler() const { return scheduler_; }
+
+        ScheduleAwaiter initial_suspend() const noexcept { return ScheduleAwaiter { scheduler_ }; }
+
+        std::suspend_never final_suspend() const noexcept { return {}; }
+
+    protected:
+        /// Awaiting a canceled task (or CancellationToken::ThrowIfCancellationRequested) throws TaskCanceledException,
+        /// which completes the coroutine as canceled, the other exceptions are stored in the returned task
+        template <class T>
+        static void CompleteWithCurrentException(Task<T>& task)
+        {
+            auto& future = const_cast<Future<T>&>(task.GetFuture());
+            try {
+                throw;
+            } catch (const TaskCanceledException&) {
+                future.SetCanceled();
+            } catch (...) {
+                future.SetException(std::current_exception());
+            }
+        }
+
+    private:
+        ITaskScheduler* scheduler_;
+    };
+
+    /// The awaiter of `co_await task`, it is stored in the coroutine frame and registers itself as the listener of the task,
+    /// so suspending allocates nothing.
+    /// The value is returned by reference if isTaking is false, otherwise it's moved out, see operator co_await
+    template <class T, bool isTaking>
+    class TaskAwaiter final : FutureListener {
+    public:
+        explicit TaskAwaiter(Task<T> task)
+            : task_ { std::move(task) }
+        {
+            assert(task_.Valid());
+        }
+
+        bool await_ready() const { return task_.GetFuture().IsReady(); }
+
+        template <class Promise>
+        void await_suspend(std::coroutine_handle<Promise> handle)
+        {
+            handle_ = handle;
+            if constexpr (std::is_base_of_v<TaskPromiseBase, Promise>) {
+                scheduler_ = handle.promise().GetScheduler();
+            }
+            task_.GetFuture().AddListener(this);
+        }
+
+        /// Rethrows the exception of a faulted task, or TaskCanceledException if it's canceled, void tasks included
+        decltype(auto) await_resume()
+        {
+            if constexpr (std::is_same_v<void, T>) {
+                task_.GetFuture().GetValue();
+            } else if constexpr (isTaking) {
+                return task_.TakeValue();
+            } else {
+                return task_.GetFuture().GetValue();
+            }
+        }
+
+    private:
+        void Invoke(const FutureBase&) final
+        {
+            isReady_ = true;
+        }
+
+        void Destroy() final
+        {
+            // Resumes here instead of in Invoke, since resuming may destroy this awaiter, and Destroy is the last access of the listener.
+            // The task is referenced by this awaiter, so its future is never destroyed before being ready
+            assert(isReady_);
+            ResumeOn(handle_, scheduler_);
+        }
+
+    private:
+        Task<T> task_;
+        std::coroutine_handle<> handle_ {};
+        ITaskScheduler* scheduler_ { nullptr };
+        bool isReady_ { false };
+    };
+
+    /// The promise of a coroutine returning Task<T>, the returned task is a proxy task which is ready once the coroutine returns.
+    /// The coroutine runs in the scheduler which is passed as its first ITaskScheduler& / ITaskScheduler* argument,
+    /// or in the default scheduler if there is no such argument.
+    template <class T>
+    class TaskPromise final : public TaskPromiseBase {
+    public:
+        using TaskPromiseBase::TaskPromiseBase;
+
+        Task<T> get_return_object()
+        {
+            task_ = MakeProxyTask<T>(*GetScheduler());
+            return task_;
+        }
+
+        template <class U>
+        void return_value(U&& value)
+        {
+            const_cast<Future<T>&>(task_.GetFuture()).SetValue(std::forward<U>(value));
+        }
+
+        void unhandled_exception() { CompleteWithCurrentException(task_); }
+
+    private:
+        Task<T> task_ {};
+    };
+
+    template <>
+    class TaskPromise<void> final : public TaskPromiseBase {
+    public:
+        using TaskPromiseBase::TaskPromiseBase;
+
+        Task<void> get_return_object()
+        {
+            task_ = MakeProxyTask<void>(*GetScheduler());
+            return task_;
+        }
+
+        void return_void()
+        {
+            const_cast<Future<void>&>(task_.GetFuture()).SetValue();
+        }
+
+        void unhandled_exception() { CompleteWithCurrentException(task_); }
+
+    private:
+        Task<void> task_ {};
+    };
+
+}
+
+/// Returns the value by const reference, which is valid as long as the task is referenced, e.g. by task
+template <class T>
+inline internal::TaskAwaiter<T, false> operator co_await(const Task<T>& task)
+{
+    return internal::TaskAwaiter<T, false>(task);
+}
+
+/// Moves the value out of the task (see Task::TakeValue), e.g. `co_await SomeCoroutine()`,
+/// so the value is neither copied nor referenced after the temporary task is released.
+/// NOTE: The task should have no other consumer of the value
+template <class T>
+inline internal::TaskAwaiter<T, true> operator co_await(Task<T>&& task)
+{
+    return internal::TaskAwaiter<T, true>(std::move(task));
+}
+
+}
+
+template <class T, class... Args>
+struct std::coroutine_traits<tpl::Task<T>, Args...> {
+    using promise_type = tpl::internal::TaskPromise<T>;
+};
+
+#endif
@@ -4,12 +4,18 @@
 
 #pragma once
 
+#include "TPL/Scheduler.h"
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <exception>
 #include <functional>
 #include <mutex>
 #include <optional>
-#include <queue>
+#include <thread>
+#include <type_traits>
 
 namespace tpl {
 
@@ -18,222 +24,591 @@ enum class WaitStatus {
     kReady,
 };
 
+/// Thrown when getting the value of a canceled future
+class TaskCanceledException : public std::exception {
+public:
+    const char* what() const noexcept override { return "The task is canceled"; }
+};
+
+/// Thrown when getting the value of a task returned by Task::WithTimeout, if the timeout expires first
+class TaskTimeoutException : public std::exception {
+public:
+    const char* what() const noexcept override { return "The task is timed out"; }
+};
+
+namespace internal {
+
+    class FutureBase;
+
+    /// An intrusive node of the listener stack of a future.
+    /// Exactly one of the following happens to a node that is added to a future:
+    /// 1. Invoke is called once the future becomes ready, then Destroy is called;
+    /// 2. Destroy is called when the future is destroyed without being ready.
+    struct FutureListener {
+        FutureListener* next { nullptr };
+
+        /// Should not throw, see FutureBase::InvokeListener
+        virtual void Invoke(const FutureBase& future) = 0;
+
+        virtual void Destroy() = 0;
+
+    protected:
+        ~FutureListener() = default;
+    };
+
+    /// Starts the producer of a lazy future once the future is demanded.
+    /// Exactly one of the following happens to a handler that is set to a future:
+    /// 1. OnDemand is called once a listener is added to the future or FutureBase::Demand is called;
+    /// 2. Destroy is called when the future is completed or destroyed without being demanded.
+    struct DemandHandler {
+        virtual void OnDemand() = 0;
+
+        virtual void Destroy() = 0;
+
+    protected:
+        ~DemandHandler() = default;
+    };
+
+    /// Runs the queued producer of a future in a helping wait for the future, instead of waiting for a worker to take it from the queue.
+    /// The queued producer is claimed by either the queue or the wait, the one that loses does nothing.
+    /// The handler is owned by the producer (e.g. the task of the future), so it's valid as long as the future is.
+    struct HelpHandler {
+        /// Runs the producer in the calling thread, which is in a helping wait of scheduler,
+        /// returns false if it's claimed already, or it's not queued in scheduler, or it's too shallow to nest (see internal::CanHelpAwaited)
+        virtual bool TryRunInWait(ITaskScheduler& scheduler) = 0;
+
+    protected:
+        ~HelpHandler() = default;
+    };
+
+    /// The state of a future is one atomic word:
+    /// nullptr: empty
+    /// ValueState(): ready with a value
+    /// CanceledState(): ready without a value since the task is canceled
+    /// pointer to a FaultRecord | 1: ready with an exception, the record is only allocated when an exception is thrown
+    /// pointer to a DemandHandler | 2: lazy, nobody has demanded it yet
+    /// others: has listeners, it points to the top of the listener stack
+    /// The listeners, the handlers and the records are aligned, so the completed states are all odd.
+    class FutureBase {
+    public:
+        FutureBase(const FutureBase&) = delete;
+        FutureBase(FutureBase&&) = delete;
+        FutureBase& operator=(const FutureBase&) = delete;
+        FutureBase& operator=(FutureBase&&) = delete;
+
+        /// Whether the future is completed, with a value, canceled or faulted
+        bool IsReady() const
+        {
+            return IsCompletedState(state_.load(std::memory_order_acquire));
+        }
+
+        /// Whether the future is ready with a value
+        bool HasValue() const
+        {
+            return state_.load(std::memory_order_acquire) == ValueState();
+        }
+
+        bool IsCanceled() const
+        {
+            return state_.load(std::memory_order_acquire) == CanceledState();
+        }
+
+        bool IsFaulted() const
+        {
+            return IsFaultedState(state_.load(std::memory_order_acquire));
+        }
+
+        /// Returns the exception thrown by the task, or nullptr if the future is not faulted
+        std::exception_ptr GetException() const
+        {
+            FutureListener* state = state_.load(std::memory_order_acquire);
+            return IsFaultedState(state) ? ToFaultRecord(state)->exception : nullptr;
+        }
+
+        /// In a worker thread of a scheduler, the queued tasks of the scheduler deeper than the waiting one are run via ITaskScheduler::TryRunOne while waiting,
+        /// so a task waiting for its children doesn't hold a worker idle, and the nested waits can't starve a fixed size pool.
+        /// The helped tasks nest on the stack no deeper than the task tree, since each one is deeper than the one it's nested in.
+        /// The awaited task itself is run via its HelpHandler if it's still queued in the scheduler, so a task waiting for a queued sibling
+        /// doesn't wait for a worker that may never come. A wait for a task that is not queued (e.g. running elsewhere, or a proxy task) just blocks
+        void Wait() const
+        {
+            if (IsReady()) {
+                return;
+            }
+            auto* scheduler = GetCurrentTaskScheduler();
+            if (scheduler != nullptr) {
+                WaitHelping(*scheduler);
+                return;
+            }
+            auto* waiter = new Waiter();
+            AddListener(waiter);
+            {
+                std::unique_lock<std::mutex> lck(waiter->mutex);
+                waiter->cv.wait(lck, [waiter]() { return waiter->isReady; });
+            }
+            waiter->Destroy();
+        }
+
+        WaitStatus WaitFor(size_t millis) const
+        {
+            if (IsReady()) {
+                return WaitStatus::kReady;
+            }
+            auto* waiter = new Waiter();
+            AddListener(waiter);
+            bool hasValue;
+            {
+                std::unique_lock<std::mutex> lck(waiter->mutex);
+                hasValue = waiter->cv.wait_for(lck, std::chrono::milliseconds(millis), [waiter]() { return waiter->isReady; });
+            }
+            // If time out, the waiter is still in the listener stack, it will be freed by the other side
+            waiter->Destroy();
+            return hasValue ? WaitStatus::kReady : WaitStatus::kTimeout;
+        }
+
+        /// Low level API, push a listener to the listener stack, or invoke it immediately if the future is ready.
+        /// NOTE: The listener should be valid until its Destroy function is called
+        void AddListener(FutureListener* listener) const
+        {
+            assert(listener != nullptr);
+            FutureListener* head = state_.load(std::memory_order_acquire);
+            if (IsLazyState(head)) {
+                // Listening is demanding
+                Demand();
+                head = state_.load(std::memory_order_acquire);
+            }
+            do {
+                if (IsCompletedState(head)) {
+                    listener->Invoke(*this);
+                    listener->Destroy();
+                    return;
+                }
+                listener->next = head;
+            } while (!state_.compare_exchange_weak(head, listener, std::memory_order_release, std::memory_order_acquire));
+        }
+
+        /// Low level API, makes the future lazy, the handler is called (in the caller's thread) once the future is demanded.
+        /// NOTE: Should be called before anyone else accesses the future
+        void SetDemandHandler(DemandHandler* handler)
+        {
+            assert(handler != nullptr);
+            assert(state_.load(std::memory_order_relaxed) == nullptr);
+            state_.store(reinterpret_cast<FutureListener*>(reinterpret_cast<uintptr_t>(handler) | 2), std::memory_order_release);
+        }
+
+        /// Low level API, called by the producer before it's queued, so a helping wait for the future can run it, see HelpHandler
+        void SetHelpHandler(HelpHandler* handler)
+        {
+            helpHandler_.store(handler, std::memory_order_release);
+        }
+
+        /// Calls the demand handler if the future is lazy and not demanded yet, otherwise does nothing
+        void Demand() const
+        {
+            FutureListener* state = state_.load(std::memory_order_acquire);
+            while (IsLazyState(state)) {
+                if (state_.compare_exchange_weak(state, nullptr, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    auto* handler = ToDemandHandler(state);
+                    handler->OnDemand();
+                    handler->Destroy();
+                    return;
+                }
+            }
+        }
+
+    protected:
+        FutureBase() = default;
+
+        explicit FutureBase(bool isReady)
+            : state_ { isReady ? ValueState() : nullptr }
+        {
+        }
+
+        ~FutureBase()
+        {
+            FutureListener* head = state_.load(std::memory_order_acquire);
+            if (IsFaultedState(head)) {
+                delete ToFaultRecord(head);
+                return;
+            }
+            if (IsCompletedState(head)) {
+                return;
+            }
+            if (IsLazyState(head)) {
+                ToDemandHandler(head)->Destroy();
+                return;
+            }
+            while (head != nullptr) {
+                FutureListener* next = head->next;
+                head->Destroy();
+                head = next;
+            }
+        }
+
+        /// Should be called after the value is stored
+        void MarkAsReady()
+        {
+            Complete(ValueState());
+        }
+
+        void MarkAsCanceled()
+        {
+            Complete(CanceledState());
+        }
+
+        void MarkAsFaulted(std::exception_ptr exception)
+        {
+            assert(exception != nullptr);
+            auto* record = new FaultRecord { std::move(exception) };
+            Complete(reinterpret_cast<FutureListener*>(reinterpret_cast<uintptr_t>(record) | 1));
+        }
+
+        /// Wait and check the state before accessing the value
+        void WaitForValue() const
+        {
+            Wait();
+            FutureListener* state = state_.load(std::memory_order_acquire);
+            if (state == CanceledState()) {
+                throw TaskCanceledException();
+            }
+            if (IsFaultedState(state)) {
+                std::rethrow_exception(ToFaultRecord(state)->exception);
+            }
+        }
+
+    private:
+        void Complete(FutureListener* completedState)
+        {
+            FutureListener* head = state_.exchange(completedState, std::memory_order_acq_rel);
+            assert(!IsCompletedState(head)); // The future is already completed
+            if (IsLazyState(head)) {
+                // Completed without being demanded (e.g. started explicitly), no one is listening
+                ToDemandHandler(head)->Destroy();
+                return;
+            }
+
+            // Reverse the stack, so that the listeners are invoked in the order they are added
+            FutureListener* reversed { nullptr };
+            while (head != nullptr) {
+                FutureListener* next = head->next;
+                head->next = reversed;
+                reversed = head;
+                head = next;
+            }
+            while (reversed != nullptr) {
+                FutureListener* next = reversed->next;
+                InvokeListener(reversed);
+                reversed->Destroy();
+                reversed = next;
+            }
+        }
+
+        /// A listener throwing here would leave the remaining ones never invoked nor destroyed, so it terminates the process instead
+        void InvokeListener(FutureListener* listener) noexcept
+        {
+            listener->Invoke(*this);
+        }
+
+    private:
+        bool TryRunHelpHandler(ITaskScheduler& scheduler) const
+        {
+            HelpHandler* handler = helpHandler_.load(std::memory_order_acquire);
+            return handler != nullptr && handler->TryRunInWait(scheduler);
+        }
+
+        void WaitHelping(ITaskScheduler& scheduler) const
+        {
+            constexpr auto kMinBackoff = std::chrono::microseconds(50);
+            constexpr auto kMaxBackoff = std::chrono::microseconds(1000);
+            auto* waiter = new Waiter();
+            AddListener(waiter);
+            auto backoff = kMinBackoff;
+            {
+                // The functors run here are nested in this wait, restored even if one of them throws
+                HelpingWaitScope helping {};
+                while (!IsReady()) {
+                    if (TryRunHelpHandler(scheduler) || scheduler.TryRunOne()) {
+                        backoff = kMinBackoff;
+                        continue;
+                    }
+                    // Nothing to run, sleeps a while, since the new tasks don't wake up the waiter
+                    std::unique_lock<std::mutex> lck(waiter->mutex);
+                    waiter->cv.wait_for(lck, backoff, [waiter]() { return waiter->isReady; });
+                    backoff = std::min<std::chrono::microseconds>(backoff * 2, kMaxBackoff);
+                }
+            }
+            waiter->Destroy();
+        }
+
+        // Only allocated when someone waits
+        struct Waiter final : FutureListener {
+            void Invoke(const FutureBase&) override
+            {
+                std::unique_lock<std::mutex> lck(mutex);
+                isReady = true;
+                cv.notify_all();
+            }
+
+            void Destroy() override
+            {
+                // Shared by the waiting thread and the future
+                if (--refCount == 0) {
+                    delete this;
+                }
+            }
+
+            std::atomic_int refCount { 2 };
+            std::mutex mutex {};
+            std::condition_variable cv {};
+            bool isReady { false };
+        };
+
+        struct alignas(8) FaultRecord {
+            std::exception_ptr exception;
+        };
+
+        static FutureListener* ValueState() { return reinterpret_cast<FutureListener*>(uintptr_t(1)); }
+
+        static FutureListener* CanceledState() { return reinterpret_cast<FutureListener*>(uintptr_t(3)); }
+
+        static bool IsCompletedState(FutureListener* state)
+        {
+            return (reinterpret_cast<uintptr_t>(state) & 1) != 0;
+        }
+
+        static bool IsFaultedState(FutureListener* state)
+        {
+            return IsCompletedState(state) && state != ValueState() && state != CanceledState();
+        }
+
+        static FaultRecord* ToFaultRecord(FutureListener* state)
+        {
+            return reinterpret_cast<FaultRecord*>(reinterpret_cast<uintptr_t>(state) & ~uintptr_t(1));
+        }
+
+        static bool IsLazyState(FutureListener* state)
+        {
+            return (reinterpret_cast<uintptr_t>(state) & 3) == 2;
+        }
+
+        static DemandHandler* ToDemandHandler(FutureListener* state)
+        {
+            return reinterpret_cast<DemandHandler*>(reinterpret_cast<uintptr_t>(state) & ~uintptr_t(2));
+        }
+
+    private:
+        mutable std::atomic<FutureListener*> state_ { nullptr };
+        std::atomic<HelpHandler*> helpHandler_ { nullptr };
+    };
+
+}
+
 template <class Ret>
-class Future {
+class Future : public internal::FutureBase {
 public:
     using ValueType = Ret;
-    using OnValueAvailable = std::function<void(ValueType)>;
+    /// The listeners take the value by reference, they should copy it by themselves if needed
+    using OnValueAvailable = std::function<void(const ValueType&)>;
 
     explicit Future() = default;
 
     explicit Future(const ValueType& value)
-        : value_ { value }
+        : FutureBase(true)
+        , value_ { value }
     {
     }
 
     explicit Future(ValueType&& value)
-        : value_ { std::move(value) }
+        : FutureBase(true)
+        , value_ { std::move(value) }
     {
     }
 
-    bool IsReady() const
+    /// Waits for the value, throws TaskCanceledException if the future is canceled, or rethrows the exception of the task if it's faulted
+    const ValueType& GetValue() const
     {
-        std::unique_lock<std::mutex> lck(mutex_);
-        return IsReadyInternal();
+        WaitForValue();
+        return GetValueInternal();
     }
 
-    void Wait() const
+    void SetValue(const ValueType& v)
     {
-        std::unique_lock<std::mutex> lck(mutex_);
-        hasValueCv_.wait(lck, [this]() { return value_.has_value(); });
+        assert(!IsReady());
+        value_.emplace(v);
+        MarkAsReady();
     }
 
-    WaitStatus WaitFor(size_t millis) const
+    void SetValue(ValueType&& v)
     {
-        bool hasValue;
-        {
-            std::unique_lock<std::mutex> lck(mutex_);
-            hasValue = hasValueCv_.wait_for(lck, std::chrono::milliseconds(millis), [this]() { return value_.has_value(); });
-        }
-        return hasValue ? WaitStatus::kReady : WaitStatus::kTimeout;
+        assert(!IsReady());
+        value_.emplace(std::move(v));
+        MarkAsReady();
     }
 
-    const ValueType& GetValue() const
+    /// Makes this future ready with the value stored in another place (e.g. the future of another task) without copying it.
+    /// NOTE: The caller should keep the value valid and unchanged during the lifetime of this future
+    void SetForwardedValue(const ValueType& v)
     {
-        Wait();
-        return GetValueInternal();
+        assert(!IsReady());
+        forwardedValue_ = &v;
+        MarkAsReady();
     }
 
-    void SetValue(const ValueType& v)
+    /// Completes the future without a value
+    void SetCanceled()
     {
-        {
-            std::unique_lock<std::mutex> lck(mutex_);
-            assert(!value_.has_value());
-            value_ = v;
-        }
-        hasValueCv_.notify_all();
-        CallAllValueListener();
+        assert(!IsReady());
+        MarkAsCanceled();
     }
 
-    void SetValue(ValueType&& v)
+    /// Completes the future with an exception, which is rethrown by GetValue
+    void SetException(std::exception_ptr exception)
     {
-        {
-            std::unique_lock<std::mutex> lck(mutex_);
-            assert(!value_.has_value());
-            value_ = std::move(v);
+        assert(!IsReady());
+        MarkAsFaulted(std::move(exception));
+    }
+
+    /// Waits and moves the value out, for the case that there is only one consumer of the value.
+    /// NOTE1: The value should not be accessed anymore after this call
+    /// NOTE2: If the value is forwarded from another future, it's copied instead, since it's not owned by this future,
+    /// unless it's move-only, it's moved out of the other future then, which should have no other consumer either
+    ValueType TakeValue()
+    {
+        WaitForValue();
+        if (forwardedValue_ != nullptr) {
+            if constexpr (std::is_copy_constructible_v<ValueType>) {
+                return *forwardedValue_;
+            } else {
+                return std::move(*const_cast<ValueType*>(forwardedValue_));
+            }
         }
-        hasValueCv_.notify_all();
-        CallAllValueListener();
+        assert(value_.has_value());
+        return std::move(value_.value());
     }
 
     /// NOTE1: The cb will on deleted once it is called
     /// NOTE2: The thread executing the callback is not ensured, and cb may be executed in the caller's thread or in the thread in which the value is set
-    void InvokeOnValueAvailable(OnValueAvailable&& cb) const
+    /// NOTE3: The cb is not called if the future is canceled or faulted
+    /// NOTE4: The cb should not throw, std::terminate is called if it throws when the future is completed
+    template <class Callback>
+    void InvokeOnValueAvailable(Callback&& cb) const
     {
-        assert(cb != nullptr);
-        OnValueAvailable callback { nullptr };
-        {
-            std::unique_lock<std::mutex> lck(mutex_);
-            if (IsReadyInternal()) {
-                callback = std::move(cb);
-            } else {
-                onValueAvailable_.push(std::move(cb));
+        if (IsReady()) {
+            if (HasValue()) {
+                cb(GetValueInternal());
             }
+            return;
         }
-        if (callback != nullptr) {
-            callback(GetValueInternal());
-        }
+        AddListener(new CallbackListener<std::decay_t<Callback>>(std::forward<Callback>(cb)));
     }
 
 private:
-    bool IsReadyInternal() const { return value_.has_value(); }
+    template <class Callback>
+    struct CallbackListener final : internal::FutureListener {
+        template <class Cb>
+        explicit CallbackListener(Cb&& cb)
+            : callback { std::forward<Cb>(cb) }
+        {
+        }
+
+        void Invoke(const FutureBase& future) override
+        {
+            if (future.HasValue()) {
+                callback(static_cast<const Future&>(future).GetValueInternal());
+            }
+        }
+
+        void Destroy() override { delete this; }
+
+        Callback callback;
+    };
 
     const ValueType& GetValueInternal() const
     {
+        if (forwardedValue_ != nullptr) {
+            return *forwardedValue_;
+        }
         assert(value_.has_value());
         return value_.value();
     }
 
-    void CallAllValueListener() const
-    {
-        OnValueAvailable cb { nullptr };
-        while (true) {
-            {
-                std::unique_lock<std::mutex> lck(mutex_);
-                if (onValueAvailable_.empty()) {
-                    break;
-                }
-
-                cb = std::move(onValueAvailable_.front());
-                onValueAvailable_.pop();
-            }
-            assert(cb != nullptr);
-            cb(GetValueInternal());
-        }
-    }
-
 private:
     std::optional<ValueType> value_ {};
-    mutable std::condition_variable hasValueCv_ {};
-    mutable std::queue<OnValueAvailable> onValueAvailable_ {};
-    mutable std::mutex mutex_ {};
+    const ValueType* forwardedValue_ { nullptr };
 };
 
 template <>
-class Future<void> {
+class Future<void> : public internal::FutureBase {
 public:
     using OnValueAvailable = std::function<void()>;
 
     Future() = default;
 
     explicit Future(bool hasValue)
-        : hasValue_ { hasValue }
-    {
-    }
-
-    bool IsReady() const
+        : FutureBase(hasValue)
     {
-        std::unique_lock<std::mutex> lck(mutex_);
-        return IsReadyInternal();
     }
 
-    void Wait() const
+    /// Waits for the future, throws TaskCanceledException if the future is canceled, or rethrows the exception of the task if it's faulted
+    void GetValue() const
     {
-        std::unique_lock<std::mutex> lck(mutex_);
-        hasValueCv_.wait(lck, [this]() { return hasValue_; });
+        WaitForValue();
     }
 
-    WaitStatus WaitFor(size_t millis) const
+    void SetValue()
     {
-        bool hasValue;
-        {
-            std::unique_lock<std::mutex> lck(mutex_);
-            hasValue = hasValueCv_.wait_for(lck, std::chrono::milliseconds(millis), [this]() { return hasValue_; });
-        }
-        return hasValue ? WaitStatus::kReady : WaitStatus::kTimeout;
+        assert(!IsReady());
+        MarkAsReady();
     }
 
-    void GetValue() const
+    void SetCanceled()
     {
-        Wait();
+        assert(!IsReady());
+        MarkAsCanceled();
     }
 
-    void SetValue()
+    void SetException(std::exception_ptr exception)
     {
-        {
-            std::unique_lock<std::mutex> lck(mutex_);
-            assert(!hasValue_);
-            hasValue_ = true;
-        }
-        hasValueCv_.notify_all();
-        CallAllValueListener();
+        assert(!IsReady());
+        MarkAsFaulted(std::move(exception));
     }
 
     /// NOTE1: The cb will on deleted once it is called
     /// NOTE2: The thread executing the callback is not ensured, and cb may be executed in the caller's thread or in the thread in which the value is set
-    void InvokeOnValueAvailable(OnValueAvailable&& cb) const
+    /// NOTE3: The cb is not called if the future is canceled or faulted
+    /// NOTE4: The cb should not throw, std::terminate is called if it throws when the future is completed
+    template <class Callback>
+    void InvokeOnValueAvailable(Callback&& cb) const
     {
-        assert(cb != nullptr);
-        OnValueAvailable callback { nullptr };
-        {
-            std::unique_lock<std::mutex> lck(mutex_);
-            if (IsReadyInternal()) {
-                callback = std::move(cb);
-            } else {
-                onValueAvailable_.push(std::move(cb));
+        if (IsReady()) {
+            if (HasValue()) {
+                cb();
             }
+            return;
         }
-        if (callback != nullptr) {
-            callback();
-        }
+        AddListener(new CallbackListener<std::decay_t<Callback>>(std::forward<Callback>(cb)));
     }
 
 private:
-    bool IsReadyInternal() const { return hasValue_; }
-
-    void CallAllValueListener() const
-    {
-        OnValueAvailable cb { nullptr };
-        while (true) {
-            {
-                std::unique_lock<std::mutex> lck(mutex_);
-                if (onValueAvailable_.empty()) {
-                    break;
-                }
+    template <class Callback>
+    struct CallbackListener final : internal::FutureListener {
+        template <class Cb>
+        explicit CallbackListener(Cb&& cb)
+            : callback { std::forward<Cb>(cb) }
+        {
+        }
 
-                cb = std::move(onValueAvailable_.front());
-                onValueAvailable_.pop();
+        void Invoke(const FutureBase& future) override
+        {
+            if (future.HasValue()) {
+                callback();
             }
-            assert(cb != nullptr);
-            cb();
         }
-    }
 
-private:
-    bool hasValue_ { false };
-    mutable std::condition_variable hasValueCv_ {};
-    mutable std::queue<OnValueAvailable> onValueAvailable_ {};
-    mutable std::mutex mutex_ {};
+        void Destroy() override { delete this; }
+
+        Callback callback;
+    };
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/Scheduler.h"
+#include <deque>
+#include <utility>
+
+namespace tpl {
+
+/// Runs the functors in the calling thread immediately, with no queueing, for the cheap stages.
+/// A functor scheduled by a running functor (e.g. a continuation) is nested up to kMaxNestedDepth,
+/// deeper ones are deferred until the outermost functor returns, so a long chain doesn't overflow the stack.
+class InlineTaskScheduler final : public ITaskScheduler {
+public:
+    static constexpr int kMaxNestedDepth = 32;
+
+    InlineTaskScheduler() = default;
+
+    InlineTaskScheduler(InlineTaskScheduler&&) = delete;
+    InlineTaskScheduler(const InlineTaskScheduler&) = delete;
+    InlineTaskScheduler& operator=(InlineTaskScheduler&&) = delete;
+    InlineTaskScheduler& operator=(const InlineTaskScheduler&) = delete;
+
+    using ITaskScheduler::Schedule;
+
+    void Schedule(const std::function<void()>& functor) final
+    {
+        Schedule(UniqueFunction<void()>(functor));
+    }
+
+    void Schedule(UniqueFunction<void()>&& functor) final
+    {
+        auto& state = tState_;
+        if (state.depth >= kMaxNestedDepth) {
+            state.deferred.emplace_back(this, std::move(functor));
+            return;
+        }
+        Run(functor);
+        if (state.depth == 0) {
+            while (!state.deferred.empty()) {
+                auto [scheduler, deferred] = std::move(state.deferred.front());
+                state.deferred.pop_front();
+                scheduler->Run(deferred);
+            }
+        }
+    }
+
+    /// NOTE: Should be set before any task is created with this scheduler
+    void SetTaskAllocator(ITaskAllocator* allocator) { taskAllocator_ = allocator; }
+
+    ITaskAllocator* GetTaskAllocator() const final { return taskAllocator_; }
+
+    size_t GetConcurrency() const final { return 1; }
+
+private:
+    void Run(UniqueFunction<void()>& functor)
+    {
+        TaskSchedulerScope scope(this);
+        ++tState_.depth;
+        functor();
+        --tState_.depth;
+    }
+
+    /// Shared by all the inline schedulers in a thread
+    struct ThreadState {
+        int depth { 0 };
+        std::deque<std::pair<InlineTaskScheduler*, UniqueFunction<void()>>> deferred {};
+    };
+
+    ITaskAllocator* taskAllocator_ { nullptr };
+
+    static thread_local ThreadState tState_;
+};
+
+}
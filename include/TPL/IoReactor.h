@@ -0,0 +1,116 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#if defined(__linux__)
+
+#include "TPL/Task.h"
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define TPL_HAS_IO_REACTOR 1
+
+namespace tpl {
+
+namespace internal {
+
+    /// A pending I/O operation of an IoReactor
+    class IoOperation {
+    public:
+        virtual ~IoOperation() = default;
+
+        /// Issues the non-blocking syscall, returns false if it would block.
+        /// Called with the reactor locked, so the future is not completed here
+        virtual bool Perform() = 0;
+
+        /// Completes the future with the result of Perform, called without the reactor locked
+        virtual void Complete() = 0;
+
+        /// Fails the operation with errno error, e.g. if the fd can't be polled
+        virtual void SetError(int error) = 0;
+
+        /// Completes the future as canceled
+        virtual void Cancel() = 0;
+    };
+
+}
+
+/// An epoll based reactor, the I/O operations return proxy tasks which are completed by Future::SetValue once the fd is ready,
+/// so the continuations (Then / Unwrap / co_await) run in the scheduler of the task as usual,
+/// and no worker is blocked by a syscall. One reactor thread waits for the events of all the fds.
+/// Each operation is tried immediately at first, it's only queued if it would block.
+/// The operations of the same fd and direction are completed in the order they are issued.
+/// A failed syscall completes the task with std::system_error.
+/// NOTE: The fds should be non-blocking, and should not be closed while any operation on them is pending.
+/// NOTE: io_uring is not used, since the fast path (the syscall succeeds immediately) covers most of the reads and writes,
+/// and epoll needs no kernel / liburing support
+class IoReactor {
+public:
+    /// The returned tasks are created with scheduler, or the default scheduler if nullptr
+    explicit IoReactor(ITaskScheduler* scheduler = nullptr);
+
+    IoReactor(IoReactor&&) = delete;
+    IoReactor(const IoReactor&) = delete;
+    IoReactor& operator=(IoReactor&&) = delete;
+    IoReactor& operator=(const IoReactor&) = delete;
+
+    /// The pending operations are completed as canceled
+    ~IoReactor();
+
+    /// Reads at most size bytes into buffer, the task is ready with the number of bytes read once any is available, 0 means end of file.
+    /// NOTE: buffer should be valid until the task is ready
+    Task<size_t> Read(int fd, void* buffer, size_t size);
+
+    /// Same as above, but the bytes are returned in a vector of at most maxSize bytes
+    Task<std::vector<char>> Read(int fd, size_t maxSize);
+
+    /// Writes all the size bytes of buffer, the task is ready with size once they are all written.
+    /// NOTE: buffer should be valid until the task is ready
+    Task<size_t> Write(int fd, const void* buffer, size_t size);
+
+    /// Accepts a connection of a listening socket, the task is ready with the accepted fd, which is non-blocking
+    Task<int> Accept(int fd);
+
+    /// The task is ready after duration
+    Task<void> Sleep(std::chrono::nanoseconds duration);
+
+private:
+    struct FdState {
+        std::deque<std::unique_ptr<internal::IoOperation>> readers {};
+        std::deque<std::unique_ptr<internal::IoOperation>> writers {};
+        bool isRegistered { false };
+    };
+
+    void Submit(int fd, bool isWrite, std::unique_ptr<internal::IoOperation> operation);
+
+    /// Performs the queued operations in order until one would block, the performed ones are moved to completed
+    static void PerformQueued(std::deque<std::unique_ptr<internal::IoOperation>>& queue, std::vector<std::unique_ptr<internal::IoOperation>>& completed);
+
+    /// Re-arms the one shot registration of fd, or unregisters it if nothing is pending.
+    /// If fd can't be registered, its pending operations are failed and moved to completed
+    void UpdateRegistration(int fd, FdState& state, std::vector<std::unique_ptr<internal::IoOperation>>& completed);
+
+    void ReactorThreadRoutine();
+
+    ITaskScheduler& GetScheduler() const;
+
+private:
+    ITaskScheduler* scheduler_;
+    int epollFd_ { -1 };
+    int wakeupFd_ { -1 };
+    std::mutex mutex_ {};
+    std::unordered_map<int, FdState> fds_ {};
+    bool isRunning_ { true };
+    std::thread thread_ {};
+};
+
+}
+
+#endif
@@ -0,0 +1,97 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/MpscQueue.h"
+#include "TPL/Scheduler.h"
+#include <functional>
+
+namespace tpl {
+
+/// A scheduler that has no thread, the functors are queued until the owner runs them by RunOne / RunUntilIdle,
+/// e.g. in the event loop of a UI / IO thread, or to run the tasks deterministically in a single thread.
+/// The functors can be scheduled from any thread, the queue is a lock-free MPSC queue.
+/// NOTE: RunOne and RunUntilIdle should be called by one thread at a time
+class ManualTaskScheduler final : public ITaskScheduler {
+public:
+    ManualTaskScheduler() = default;
+
+    ManualTaskScheduler(ManualTaskScheduler&&) = delete;
+    ManualTaskScheduler(const ManualTaskScheduler&) = delete;
+    ManualTaskScheduler& operator=(ManualTaskScheduler&&) = delete;
+    ManualTaskScheduler& operator=(const ManualTaskScheduler&) = delete;
+
+    /// The functors not run yet are destroyed without being run
+    ~ManualTaskScheduler() final = default;
+
+    using ITaskScheduler::Schedule;
+
+    void Schedule(const std::function<void()>& functor) final
+    {
+        Schedule(UniqueFunction<void()>(functor));
+    }
+
+    void Schedule(UniqueFunction<void()>&& functor) final
+    {
+        queue_.Push(QueuedFunctor { std::move(functor), internal::tTaskDepth + 1 });
+        if (wakeup_ != nullptr) {
+            wakeup_();
+        }
+    }
+
+    /// Called after each functor is queued, e.g. to post a message to wake up the event loop.
+    /// NOTE: Should be set before any functor is scheduled, it may be called in any thread
+    void SetWakeup(std::function<void()> wakeup) { wakeup_ = std::move(wakeup); }
+
+    /// Runs one queued functor in the calling thread, returns false if there is none
+    bool RunOne()
+    {
+        QueuedFunctor item;
+        if (!queue_.Pop(item)) {
+            return false;
+        }
+        TaskSchedulerScope scope(this);
+        internal::TaskDepthScope depth(item.depth);
+        item.functor();
+        return true;
+    }
+
+    /// Called by Future::Wait in the functors run by RunOne, only runs the next functor if it's deeper than the waiting one
+    bool TryRunOne() final
+    {
+        auto* front = queue_.Front();
+        return front != nullptr && front->depth > internal::tTaskDepth && RunOne();
+    }
+
+    /// Runs the queued functors, including the ones scheduled by them, until the queue is empty.
+    /// Returns the number of the functors run
+    size_t RunUntilIdle()
+    {
+        size_t count = 0;
+        while (RunOne()) {
+            ++count;
+        }
+        return count;
+    }
+
+    /// NOTE: Should be set before any task is created with this scheduler
+    void SetTaskAllocator(ITaskAllocator* allocator) { taskAllocator_ = allocator; }
+
+    ITaskAllocator* GetTaskAllocator() const final { return taskAllocator_; }
+
+    size_t GetConcurrency() const final { return 1; }
+
+private:
+    struct QueuedFunctor {
+        UniqueFunction<void()> functor {};
+        uint32_t depth { 0 };
+    };
+
+    MpscQueue<QueuedFunctor> queue_ {};
+    std::function<void()> wakeup_ { nullptr };
+    ITaskAllocator* taskAllocator_ { nullptr };
+};
+
+}
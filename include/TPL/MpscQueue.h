@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/Platform.h"
+#include <atomic>
+#include <optional>
+#include <utility>
+
+namespace tpl {
+
+/// A lock-free unbounded multiple producer single consumer queue (Vyukov's), a node is allocated per item.
+/// Push is one exchange, and Pop touches no shared counter.
+/// NOTE: Pop may return false while a Push is in progress, i.e. between its exchange and the link of the node
+template <class T>
+class MpscQueue {
+public:
+    MpscQueue()
+        : head_ { &stub_ }
+        , tail_ { &stub_ }
+    {
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue(MpscQueue&&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+    MpscQueue& operator=(MpscQueue&&) = delete;
+
+    ~MpscQueue()
+    {
+        T item;
+        while (Pop(item)) {
+        }
+        if (tail_ != &stub_) {
+            delete tail_;
+        }
+    }
+
+    /// Can be called by any thread
+    void Push(T item)
+    {
+        auto* node = new Node();
+        node->value.emplace(std::move(item));
+        Node* previous = head_.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    /// Can only be called by the consumer thread
+    bool Pop(T& item)
+    {
+        Node* tail = tail_;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return false;
+        }
+        // The popped node becomes the new stub
+        item = std::move(*next->value);
+        next->value.reset();
+        tail_ = next;
+        if (tail != &stub_) {
+            delete tail;
+        }
+        return true;
+    }
+
+    /// The item Pop would return, or nullptr if none. Can only be called by the consumer thread
+    T* Front()
+    {
+        Node* next = tail_->next.load(std::memory_order_acquire);
+        return next != nullptr ? &*next->value : nullptr;
+    }
+
+    /// Can only be called by the consumer thread
+    bool Empty() const
+    {
+        return tail_->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node*> next { nullptr };
+        std::optional<T> value {};
+    };
+
+    // Written by the producers
+    alignas(internal::kCacheLineSize) std::atomic<Node*> head_;
+    // Owned by the consumer
+    alignas(internal::kCacheLineSize) Node* tail_;
+    Node stub_ {};
+};
+
+}
@@ -0,0 +1,193 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/Algorithm.h"
+#include "TPL/Task.h"
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace tpl {
+
+/// Moves the stages after it in a Pipeline to another scheduler
+struct RunOn {
+    explicit RunOn(ITaskScheduler* s)
+        : scheduler { s }
+    {
+    }
+
+    ITaskScheduler* scheduler;
+};
+
+namespace internal {
+
+    /// The stages of an empty segment, i.e. a segment started by RunOn with no stage yet
+    struct EmptyStage {
+    };
+
+    /// Two stages fused in one functor, the value returned by First is passed to Second directly,
+    /// or Second is invoked with no argument if First returns void
+    template <class First, class Second>
+    struct FusedStage {
+        template <class... Args>
+        auto operator()(Args&&... args)
+        {
+            if constexpr (std::is_void_v<std::invoke_result_t<First&, Args...>>) {
+                first(std::forward<Args>(args)...);
+                return second();
+            } else {
+                return second(first(std::forward<Args>(args)...));
+            }
+        }
+
+        First first;
+        Second second;
+    };
+
+    template <class Stages, class Stage>
+    inline auto FuseStages(Stages&& stages, Stage&& stage)
+    {
+        if constexpr (std::is_same_v<std::decay_t<Stages>, EmptyStage>) {
+            return std::decay_t<Stage>(std::forward<Stage>(stage));
+        } else {
+            return FusedStage<std::decay_t<Stages>, std::decay_t<Stage>> { std::forward<Stages>(stages), std::forward<Stage>(stage) };
+        }
+    }
+
+    /// The stages between two scheduler changes, they run as one task.
+    /// If scheduler == nullptr, the scheduler of the upstream task is used
+    template <class Stages>
+    struct PipelineSegment {
+        using StagesType = Stages;
+
+        ITaskScheduler* scheduler;
+        Stages stages;
+    };
+
+}
+
+/// A chain of transforms, which is built statically by `Pipeline(f1) | f2 | RunOn(scheduler) | f3`, and run by `task | pipeline` or Run.
+/// Each stage is invoked with the value returned by the previous one (or with nothing if it returns void).
+/// The adjacent stages are fused into one functor at compile time, so a run of them costs one task, with no type erasure between them,
+/// only a RunOn breaks the chain into another task, which is a continuation of the previous one in the given scheduler.
+/// The fan-in points are the tasks depending on several parents, e.g. made by MakeTask with the results of several pipelines.
+template <class... Stages>
+class Pipeline {
+    static_assert(sizeof...(Stages) > 0);
+
+public:
+    template <class Stage, class = std::enable_if_t<sizeof...(Stages) == 1 && !std::is_same_v<std::decay_t<Stage>, Pipeline>>>
+    explicit Pipeline(Stage&& stage)
+        : segments_ { internal::PipelineSegment<Stages> { nullptr, std::forward<Stage>(stage) }... }
+    {
+    }
+
+    /// Appends a stage, it is fused into the last segment
+    template <class Stage>
+    friend auto operator|(Pipeline pipeline, Stage&& stage)
+    {
+        return std::move(pipeline).Append(std::forward<Stage>(stage), std::index_sequence_for<Stages...> {});
+    }
+
+    /// Starts a new segment in the scheduler, or moves the last segment if it has no stage yet
+    friend auto operator|(Pipeline pipeline, RunOn runOn)
+    {
+        assert(runOn.scheduler != nullptr);
+        using LastStages = std::tuple_element_t<sizeof...(Stages) - 1, std::tuple<Stages...>>;
+        if constexpr (std::is_same_v<LastStages, internal::EmptyStage>) {
+            std::get<sizeof...(Stages) - 1>(pipeline.segments_).scheduler = runOn.scheduler;
+            return pipeline;
+        } else {
+            return Pipeline<Stages..., internal::EmptyStage>(std::tuple_cat(
+                std::move(pipeline.segments_), std::make_tuple(internal::PipelineSegment<internal::EmptyStage> { runOn.scheduler, {} })));
+        }
+    }
+
+    /// Runs the pipeline with the value of upstream once it is ready, the first segment runs in the scheduler of upstream by default.
+    /// The tasks are continuations made by Then, so they inherit the priority and the cancellation token of upstream
+    template <class T>
+    friend auto operator|(const Task<T>& upstream, Pipeline pipeline)
+    {
+        return std::move(pipeline).template ChainFrom<0>(upstream, nullptr);
+    }
+
+    /// Runs the pipeline whose first stage takes no argument, and returns the task of the last segment.
+    /// The first segment is started here unless options.isLazy, where the pipeline is started once the returned task is demanded
+    auto Run(ITaskScheduler* scheduler, const TaskOptions& options = {}) &&
+    {
+        auto& first = std::get<0>(segments_);
+        if (first.scheduler != nullptr) {
+            scheduler = first.scheduler;
+        }
+        auto head = MakeTask(std::move(first.stages), &internal::ResolveScheduler(scheduler), options);
+        if (!options.isLazy) {
+            head.Start();
+        }
+        if constexpr (sizeof...(Stages) > 1) {
+            return std::move(*this).template ChainFrom<1>(head, &options);
+        } else {
+            return head;
+        }
+    }
+
+private:
+    explicit Pipeline(std::tuple<internal::PipelineSegment<Stages>...>&& segments)
+        : segments_ { std::move(segments) }
+    {
+    }
+
+    template <class Stage, size_t... Indices>
+    auto Append(Stage&& stage, std::index_sequence<Indices...>) &&
+    {
+        constexpr size_t kLast = sizeof...(Stages) - 1;
+        auto fuse = [&stage](auto&& segment, auto index) {
+            if constexpr (decltype(index)::value == kLast) {
+                auto stages = internal::FuseStages(std::move(segment.stages), std::forward<Stage>(stage));
+                return internal::PipelineSegment<decltype(stages)> { segment.scheduler, std::move(stages) };
+            } else {
+                return std::move(segment);
+            }
+        };
+        auto segments = std::make_tuple(fuse(std::move(std::get<Indices>(segments_)), std::integral_constant<size_t, Indices> {})...);
+        return std::apply([](auto&&... s) { return Pipeline<typename std::decay_t<decltype(s)>::StagesType...>(std::make_tuple(std::move(s)...)); },
+            std::move(segments));
+    }
+
+    /// If options == nullptr, the options are inherited from upstream
+    template <size_t Index, class T>
+    auto ChainFrom(Task<T> upstream, const TaskOptions* options) &&
+    {
+        auto& segment = std::get<Index>(segments_);
+        static_assert(!std::is_same_v<decltype(segment.stages), internal::EmptyStage>, "A pipeline segment should have at least one stage");
+        ITaskScheduler* scheduler = segment.scheduler != nullptr ? segment.scheduler : upstream.GetScheduler();
+        auto functor = [stages = std::move(segment.stages)](const Task<T>& parent) mutable {
+            // The parent has a value here, otherwise this task is completed as failed without being run
+            if constexpr (std::is_void_v<T>) {
+                return stages();
+            } else {
+                return stages(parent.GetFuture().GetValue());
+            }
+        };
+        auto task = options != nullptr ? upstream.Then(std::move(functor), *options, scheduler) : upstream.Then(std::move(functor), scheduler);
+        if constexpr (Index + 1 < sizeof...(Stages)) {
+            return std::move(*this).template ChainFrom<Index + 1>(task, options);
+        } else {
+            return task;
+        }
+    }
+
+private:
+    std::tuple<internal::PipelineSegment<Stages>...> segments_;
+
+    template <class... Others>
+    friend class Pipeline;
+};
+
+template <class Stage>
+Pipeline(Stage) -> Pipeline<Stage>;
+
+}
@@ -0,0 +1,34 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+namespace tpl {
+
+namespace internal {
+
+    /// The alignment to keep the data written by different threads in different cache lines.
+    /// std::hardware_destructive_interference_size is not used since it depends on the compiler flags (e.g. -mtune),
+    /// which makes the layout of the classes in the headers differ between the translation units
+    constexpr size_t kCacheLineSize = 64;
+
+    /// A hint to the CPU that the thread is spinning
+    inline void CpuRelax()
+    {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield");
+#endif
+    }
+
+}
+
+}
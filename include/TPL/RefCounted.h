@@ -13,23 +13,32 @@ struct RefCounted {
     std::atomic_int refCount { 0 };
     virtual ~RefCounted() = default;
 
+    /// A new reference is always copied from an existing one, which keeps the object alive, so no ordering is needed
     void AddRef()
     {
-        assert(refCount >= 0);
-        ++refCount;
+        assert(refCount.load(std::memory_order_relaxed) >= 0);
+        refCount.fetch_add(1, std::memory_order_relaxed);
     }
 
+    /// The release makes the accesses through this reference visible to the thread deleting the object, and the acquire of the last one sees them all
     void Release()
     {
-        assert(refCount > 0);
-        if (--refCount == 0) {
+        assert(refCount.load(std::memory_order_relaxed) > 0);
+        if (refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
             Delete(this);
         }
     }
 
     static void Delete(RefCounted* obj)
     {
-        delete obj;
+        obj->DeleteSelf();
+    }
+
+protected:
+    /// Override this function if the object is not allocated by the global new, e.g. from a pool or an arena
+    virtual void DeleteSelf()
+    {
+        delete this;
     }
 };
 
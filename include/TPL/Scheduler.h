@@ -4,48 +4,291 @@
 
 #pragma once
 
+#include "TPL/Platform.h"
+#include "TPL/Stats.h"
+#include "TPL/Topology.h"
+#include "TPL/UniqueFunction.h"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <iostream>
+#include <list>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
 #include <vector>
 
 namespace tpl {
 
+class ITaskAllocator;
+
+enum class TaskPriority : uint8_t {
+    kHigh, // Latency critical tasks
+    kNormal,
+    kBackground, // Bulk tasks that may be delayed by the others
+};
+
+constexpr size_t kNumberOfTaskPriorities = 3;
+
+/// The hints passed along with the functors, a scheduler may ignore them
+struct ScheduleOptions {
+    TaskPriority priority { TaskPriority::kNormal };
+    /// The functor continues work that is already in flight (e.g. a task whose parents are done, a resumed coroutine, a fired timer),
+    /// it may be scheduled by any thread (e.g. the timer or the reactor thread), so a bounded scheduler never blocks or rejects it
+    bool isContinuation { false };
+};
+
+/// Thrown by the Schedule functions of a full scheduler with OverflowPolicy::kReject
+class TaskRejectedException : public std::exception {
+public:
+    const char* what() const noexcept override { return "The task is rejected since the queue is full"; }
+};
+
 class ITaskScheduler {
 public:
     virtual ~ITaskScheduler() = default;
 
     virtual void Schedule(const std::function<void()>& functor) = 0;
+
+    /// The move only version, which is used by tasks.
+    /// The default implementation wraps the functor and forwards it to the std::function version,
+    /// override it to avoid the extra allocation.
+    virtual void Schedule(UniqueFunction<void()>&& functor)
+    {
+        auto holder = std::make_shared<UniqueFunction<void()>>(std::move(functor));
+        Schedule(std::function<void()>([holder]() { (*holder)(); }));
+    }
+
+    /// The default implementation ignores the options
+    virtual void Schedule(UniqueFunction<void()>&& functor, const ScheduleOptions& options)
+    {
+        (void)options;
+        Schedule(std::move(functor));
+    }
+
+    /// Schedules the functor only if the scheduler can take it without blocking, returns false if it's rejected,
+    /// in which case the functor is not moved. The default implementation always schedules it
+    virtual bool TrySchedule(UniqueFunction<void()>&& functor, const ScheduleOptions& options)
+    {
+        Schedule(std::move(functor), options);
+        return true;
+    }
+
+    bool TrySchedule(UniqueFunction<void()>&& functor)
+    {
+        return TrySchedule(std::move(functor), ScheduleOptions {});
+    }
+
+    /// Schedules count functors at once, the functors are moved.
+    /// The default implementation schedules them one by one, override it to reduce the synchronization
+    virtual void ScheduleBatch(UniqueFunction<void()>* functors, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            Schedule(std::move(functors[i]));
+        }
+    }
+
+    /// The default implementation ignores the options
+    virtual void ScheduleBatch(UniqueFunction<void()>* functors, size_t count, const ScheduleOptions& options)
+    {
+        (void)options;
+        ScheduleBatch(functors, count);
+    }
+
+    /// Runs one queued functor in the calling thread, returns false if there is none that the calling thread can take.
+    /// Used by Future::Wait to run the other tasks while a worker is waiting, the functor should be deeper than internal::tTaskDepth.
+    /// The default implementation runs nothing
+    virtual bool TryRunOne() { return false; }
+
+    /// The allocator of the tasks created with this scheduler, nullptr means the global new/delete
+    virtual ITaskAllocator* GetTaskAllocator() const { return nullptr; }
+
+    /// The number of functors that may be executed simultaneously, used as a hint to split the work
+    virtual size_t GetConcurrency() const { return std::max(1u, std::thread::hardware_concurrency()); }
+
+    /// A snapshot of the counters, which is empty unless TPL_ENABLE_STATS is defined and the scheduler is instrumented
+    virtual SchedulerStats GetStats() const { return {}; }
 };
 
+extern thread_local ITaskScheduler* tCurrentTaskScheduler;
+
+namespace internal {
+
+    /// The nesting depth of the functor running in the calling thread, 0 if none.
+    /// The schedulers stamp a functor with the depth of the scheduling thread + 1, and a helping wait (see ITaskScheduler::TryRunOne)
+    /// only runs the functors deeper than the waiting one: a child never waits for the task which is suspended under it,
+    /// so the workers can't wait for each other's suspended tasks forever
+    extern thread_local uint32_t tTaskDepth;
+
+    /// The depth of the task whose helping wait the running functor is nested in (directly or via the inline runs), 0 if none
+    extern thread_local uint32_t tHelpingWaitDepth;
+
+    /// Whether the calling thread is in a helping wait of the running functor, i.e. a functor run now is nested in the wait
+    extern thread_local bool tIsHelpingWait;
+
+    /// Whether a helping wait may run the queued task it waits for directly (see FutureBase::SetHelpHandler):
+    /// one deeper than the waiting task, or deeper than the wait under the waiting task,
+    /// so a task at the bottom of a worker can run any queued task it waits for, e.g. a sibling
+    inline bool CanHelpAwaited(uint32_t depth)
+    {
+        return depth > tTaskDepth || depth > tHelpingWaitDepth;
+    }
+
+    class TaskDepthScope {
+    public:
+        explicit TaskDepthScope(uint32_t depth)
+            : previous_ { tTaskDepth }
+            , previousWaitDepth_ { tHelpingWaitDepth }
+            , previousIsHelpingWait_ { tIsHelpingWait }
+        {
+            if (tIsHelpingWait) {
+                tHelpingWaitDepth = tTaskDepth;
+            }
+            tIsHelpingWait = false;
+            tTaskDepth = depth;
+        }
+
+        TaskDepthScope(TaskDepthScope&&) = delete;
+        TaskDepthScope(const TaskDepthScope&) = delete;
+        TaskDepthScope& operator=(TaskDepthScope&&) = delete;
+        TaskDepthScope& operator=(const TaskDepthScope&) = delete;
+
+        ~TaskDepthScope()
+        {
+            tTaskDepth = previous_;
+            tHelpingWaitDepth = previousWaitDepth_;
+            tIsHelpingWait = previousIsHelpingWait_;
+        }
+
+    private:
+        uint32_t previous_;
+        uint32_t previousWaitDepth_;
+        bool previousIsHelpingWait_;
+    };
+
+    /// Marks the calling thread as in a helping wait, so the functors run in the scope are nested in it, see TaskDepthScope
+    class HelpingWaitScope {
+    public:
+        HelpingWaitScope()
+            : previous_ { tIsHelpingWait }
+        {
+            tIsHelpingWait = true;
+        }
+
+        HelpingWaitScope(HelpingWaitScope&&) = delete;
+        HelpingWaitScope(const HelpingWaitScope&) = delete;
+        HelpingWaitScope& operator=(HelpingWaitScope&&) = delete;
+        HelpingWaitScope& operator=(const HelpingWaitScope&) = delete;
+
+        ~HelpingWaitScope()
+        {
+            tIsHelpingWait = previous_;
+        }
+
+    private:
+        bool previous_;
+    };
+
+}
+
+/// Returns the scheduler which owns the calling thread as a worker thread, or nullptr if the calling thread is not a worker thread
+inline ITaskScheduler* GetCurrentTaskScheduler()
+{
+    return tCurrentTaskScheduler;
+}
+
+/// Marks the calling thread as a worker thread of the scheduler in this scope, custom schedulers may use it in their worker loops
+class TaskSchedulerScope {
+public:
+    explicit TaskSchedulerScope(ITaskScheduler* scheduler)
+        : previous_ { tCurrentTaskScheduler }
+    {
+        tCurrentTaskScheduler = scheduler;
+    }
+
+    TaskSchedulerScope(TaskSchedulerScope&&) = delete;
+    TaskSchedulerScope(const TaskSchedulerScope&) = delete;
+    TaskSchedulerScope& operator=(TaskSchedulerScope&&) = delete;
+    TaskSchedulerScope& operator=(const TaskSchedulerScope&) = delete;
+
+    ~TaskSchedulerScope()
+    {
+        tCurrentTaskScheduler = previous_;
+    }
+
+private:
+    ITaskScheduler* previous_;
+};
+
+/// What a bounded ParallelTaskScheduler does with the functors scheduled while its queue is full
+enum class OverflowPolicy : uint8_t {
+    kBlock, // Schedule blocks the producer until there is room
+    kReject, // Schedule throws TaskRejectedException, a task started in the full scheduler is faulted with it instead
+    kRunInCaller, // The functors that don't fit run in the producer thread
+};
+
+/// A scheduler with a shared queue for each priority.
+/// The workers take the tasks of the highest priority first, but a lane that is passed over kMaxSkipCount times
+/// while it has tasks is served once, so the background tasks are never starved.
+/// An idle worker spins, then yields, then parks, and the parked workers are only notified if no spinning worker can take the task.
+/// The pool grows up to Options::maxThreads when the tasks are queued up, and shrinks down to Options::minThreads when idle.
+/// The queue can be bounded by Options::capacity, the overflow is handled by Options::overflowPolicy, TrySchedule never blocks.
+/// The functors scheduled by the workers themselves and the continuations (ScheduleOptions::isContinuation) are always queued,
+/// since blocking or rejecting them could stall the workers that drain the queue, or the timer and reactor threads completing the tasks.
 class ParallelTaskScheduler final : public ITaskScheduler {
 public:
+    static constexpr size_t kMaxSkipCount = 16;
+
+    struct Options {
+        /// The number of workers that are kept even if they are idle
+        size_t minThreads { 1 };
+        /// More workers are created when there are more queued tasks than the idle workers
+        size_t maxThreads { std::max(1u, std::thread::hardware_concurrency()) };
+        /// An idle worker checks the queue spinCount times with a cpu relax instruction, then yieldCount times with yielding,
+        /// then parks on the condition variable
+        size_t spinCount { 256 };
+        size_t yieldCount { 16 };
+        /// A parked worker exits if no task arrives in idleTimeout and there are more than minThreads workers
+        std::chrono::milliseconds idleTimeout { 1000 };
+        /// The workers are pinned to this cpu set (each one may run on any cpu of the set), not pinned if it's empty
+        std::vector<int> cpus {};
+        /// The max number of queued functors of all the priorities, 0 means unbounded
+        size_t capacity { 0 };
+        OverflowPolicy overflowPolicy { OverflowPolicy::kBlock };
+        /// Called in the producer thread with the queue depth once the depth reaches highWatermark (0 means never),
+        /// it's called again only after the depth falls to highWatermark / 2, e.g. to make the upstream shed load
+        size_t highWatermark { 0 };
+        std::function<void(size_t)> onHighWatermark { nullptr };
+    };
+
     ParallelTaskScheduler()
+        : ParallelTaskScheduler(std::max(1u, std::thread::hardware_concurrency()))
     {
-        workerThreads_.resize(std::thread::hardware_concurrency());
-
-        isRunning_ = true;
-        for (auto& th : workerThreads_) {
-            th = std::thread([this]() {
-                WorkerThreadRoutine();
-            });
-        }
     }
 
+    /// Creates a fixed size pool
     ParallelTaskScheduler(size_t numThreads)
+        : ParallelTaskScheduler(MakeFixedSizeOptions(numThreads))
+    {
+    }
+
+    explicit ParallelTaskScheduler(const Options& options)
+        : options_ { options }
     {
-        assert(numThreads > 0); // Ensure the thread number > 0
-        workerThreads_.resize(numThreads);
+        assert(options.minThreads > 0); // Ensure the thread number > 0
+        assert(options.minThreads <= options.maxThreads);
+        assert(options.highWatermark == 0 || options.onHighWatermark != nullptr);
 
         isRunning_ = true;
-        for (auto& th : workerThreads_) {
-            th = std::thread([this]() {
-                WorkerThreadRoutine();
-            });
+        std::unique_lock<std::mutex> lck(queueMutex_);
+        for (size_t i = 0; i < options_.minThreads; ++i) {
+            StartWorker();
         }
     }
 
@@ -61,55 +304,377 @@ public:
             isRunning_ = false;
         }
         queueCv_.notify_all();
-        for (auto& th : workerThreads_) {
-            if (th.joinable()) {
-                th.join();
+        notFullCv_.notify_all();
+        // No worker is started or moves itself to exitedThreads_ once isRunning_ is false,
+        // but a worker draining the queue may have started one just before, so join until none is left
+        while (true) {
+            std::list<std::thread> threads;
+            {
+                std::unique_lock<std::mutex> lck(queueMutex_);
+                threads.splice(threads.end(), workerThreads_);
+                threads.splice(threads.end(), exitedThreads_);
+            }
+            if (threads.empty()) {
+                break;
+            }
+            for (auto& th : threads) {
+                if (th.joinable()) {
+                    th.join();
+                }
             }
         }
     }
 
     void Schedule(const std::function<void()>& functor) final
     {
+        Schedule(UniqueFunction<void()>(functor));
+    }
+
+    void Schedule(UniqueFunction<void()>&& functor) final
+    {
+        Schedule(std::move(functor), ScheduleOptions {});
+    }
+
+    void Schedule(UniqueFunction<void()>&& functor, const ScheduleOptions& options) final
+    {
+        Enqueue(&functor, 1, options, false);
+    }
+
+    using ITaskScheduler::TrySchedule;
+
+    bool TrySchedule(UniqueFunction<void()>&& functor, const ScheduleOptions& options) final
+    {
+        return Enqueue(&functor, 1, options, true);
+    }
+
+    void ScheduleBatch(UniqueFunction<void()>* functors, size_t count) final
+    {
+        ScheduleBatch(functors, count, ScheduleOptions {});
+    }
+
+    void ScheduleBatch(UniqueFunction<void()>* functors, size_t count, const ScheduleOptions& options) final
+    {
+        if (count == 0) {
+            return;
+        }
+        Enqueue(functors, count, options, false);
+    }
+
+    bool TryRunOne() final
+    {
+        QueuedTask task;
         {
             std::unique_lock<std::mutex> lck(queueMutex_);
-            ++taskCount_;
-            taskQueue_.push(functor);
+            if (taskCount_.load(std::memory_order_relaxed) == 0 || !PopNewestTask(task)) {
+                return false;
+            }
+            CountOutTask();
         }
-        queueCv_.notify_one();
+        internal::TaskDepthScope depth(task.depth);
+        task.functor();
+        return true;
+    }
+
+    /// NOTE: Should be set before any task is created with this scheduler
+    void SetTaskAllocator(ITaskAllocator* allocator) { taskAllocator_ = allocator; }
+
+    ITaskAllocator* GetTaskAllocator() const final { return taskAllocator_; }
+
+    size_t GetConcurrency() const final { return options_.maxThreads; }
+
+    /// The current number of workers
+    size_t GetThreadCount() const
+    {
+        std::unique_lock<std::mutex> lck(queueMutex_);
+        return threadCount_;
+    }
+
+    /// The queue depth is always reported, the worker stats only if TPL_ENABLE_STATS is defined
+    SchedulerStats GetStats() const final
+    {
+        SchedulerStats stats;
+        std::unique_lock<std::mutex> lck(queueMutex_);
+        stats.queueDepth = taskCount_.load(std::memory_order_relaxed);
+        workerCounters_.Snapshot(stats);
+        return stats;
     }
 
 private:
-    void WorkerThreadRoutine()
+    struct QueuedTask {
+        UniqueFunction<void()> functor {};
+        uint32_t depth { 0 };
+#if defined(TPL_ENABLE_STATS)
+        internal::EnqueueStamp stamp {};
+#endif
+    };
+
+    static Options MakeFixedSizeOptions(size_t numThreads)
+    {
+        Options options;
+        options.minThreads = numThreads;
+        options.maxThreads = numThreads;
+        return options;
+    }
+
+    /// Should be called with queueMutex_ locked
+    void StartWorker()
+    {
+        ++threadCount_;
+        auto* counters = workerCounters_.Add();
+        auto self = workerThreads_.emplace(workerThreads_.end());
+        *self = std::thread([this, self, counters]() {
+            WorkerThreadRoutine(self, counters);
+        });
+    }
+
+    /// Returns false if the functors are rejected by TrySchedule, see OverflowPolicy
+    bool Enqueue(UniqueFunction<void()>* functors, size_t count, const ScheduleOptions& options, bool isTry)
     {
+        size_t notifyCount { 0 };
+        size_t queuedCount { count };
+        size_t reachedDepth { 0 };
+        std::list<std::thread> exitedThreads;
+        {
+            std::unique_lock<std::mutex> lck(queueMutex_);
+            const bool isBounded = options_.capacity != 0 && !options.isContinuation && (isTry || GetCurrentTaskScheduler() != this);
+            if (isBounded && !HasRoom(count)) {
+                if (isTry) {
+                    return false;
+                } else if (options_.overflowPolicy == OverflowPolicy::kRunInCaller) {
+                    queuedCount = options_.capacity - std::min(options_.capacity, taskCount_.load(std::memory_order_relaxed));
+                } else if (options_.overflowPolicy == OverflowPolicy::kReject) {
+                    throw TaskRejectedException();
+                } else {
+                    ++blockedProducerCount_;
+                    notFullCv_.wait(lck, [this, count]() { return HasRoom(count) || !isRunning_; });
+                    --blockedProducerCount_;
+                }
+            }
+
+            auto& queue = taskQueues_[static_cast<size_t>(options.priority)];
+            const uint32_t depth = internal::tTaskDepth + 1;
+            for (size_t i = 0; i < queuedCount; ++i) {
+                queue.push_back(QueuedTask { std::move(functors[i]), depth });
+            }
+            size_t taskCount = taskCount_.load(std::memory_order_relaxed) + queuedCount;
+            taskCount_.store(taskCount, std::memory_order_seq_cst);
+
+            // Pairs with the spinningWorkerCount_ increment in WaitForTask, either the spinning worker sees the task, or we see it's not spinning
+            size_t spinningCount = spinningWorkerCount_.load(std::memory_order_seq_cst);
+            if (taskCount > spinningCount) {
+                notifyCount = std::min(taskCount - spinningCount, parkedWorkerCount_);
+                // Grow if the tasks can't be taken by the idle workers, but not while being destroyed, the remaining workers drain the queue
+                size_t growCount = isRunning_ ? std::min(taskCount - spinningCount - notifyCount, options_.maxThreads - threadCount_) : 0;
+                for (size_t i = 0; i < growCount; ++i) {
+                    StartWorker();
+                }
+            }
+            if (options_.highWatermark != 0 && !isHighWatermarkReached_ && taskCount >= options_.highWatermark) {
+                isHighWatermarkReached_ = true;
+                reachedDepth = taskCount;
+            }
+            if (isRunning_) {
+                // Joined by the destructor otherwise
+                exitedThreads.swap(exitedThreads_);
+            }
+        }
+        // Only wake up the workers needed
+        for (size_t i = 0; i < notifyCount; ++i) {
+            queueCv_.notify_one();
+        }
+        for (auto& th : exitedThreads) {
+            th.join();
+        }
+        if (reachedDepth != 0) {
+            options_.onHighWatermark(reachedDepth);
+        }
+        if (queuedCount < count) {
+            RunInCaller(functors + queuedCount, count - queuedCount);
+        }
+        return true;
+    }
+
+    /// Runs the overflow of OverflowPolicy::kRunInCaller, nested in the caller like the functors run by a worker, see TaskDepthScope.
+    /// All of them run even if one throws, the first exception is rethrown to the producer afterwards
+    static void RunInCaller(UniqueFunction<void()>* functors, size_t count)
+    {
+        const uint32_t depth = internal::tTaskDepth + 1;
+        std::exception_ptr exception { nullptr };
+        for (size_t i = 0; i < count; ++i) {
+            internal::TaskDepthScope depthScope(depth);
+            try {
+                functors[i]();
+            } catch (...) {
+                if (exception == nullptr) {
+                    exception = std::current_exception();
+                }
+            }
+        }
+        if (exception != nullptr) {
+            std::rethrow_exception(exception);
+        }
+    }
+
+    /// Should be called with queueMutex_ locked.
+    /// A batch larger than the capacity is taken once the queue is empty, so it's never blocked forever
+    bool HasRoom(size_t count) const
+    {
+        size_t taskCount = taskCount_.load(std::memory_order_relaxed);
+        return taskCount == 0 || taskCount + count <= options_.capacity;
+    }
+
+    void WorkerThreadRoutine(std::list<std::thread>::iterator self, internal::WorkerCounters* counters)
+    {
+        if (!options_.cpus.empty()) {
+            PinCurrentThread(options_.cpus);
+        }
+        TaskSchedulerScope scope(this);
         while (true) {
-            std::function<void()> functor { nullptr };
+            auto idleStart = internal::StatsNow();
+            QueuedTask task = WaitForTask(self, counters);
+            if (task.functor == nullptr) {
+                break;
+            }
+            counters->RecordIdle(idleStart);
+            auto runStart = internal::StatsNow();
             {
-                std::unique_lock<std::mutex> lck(queueMutex_);
-                queueCv_.wait(lck, [this]() {
-                    return taskCount_ > 0 || !isRunning_;
-                });
-                if (!isRunning_ && taskCount_ == 0) {
-                    break;
+                internal::TaskDepthScope depth(task.depth);
+                task.functor();
+            }
+            counters->RecordRun(runStart);
+        }
+    }
+
+    /// Returns an empty task if the worker should exit
+    QueuedTask WaitForTask(std::list<std::thread>::iterator self, internal::WorkerCounters* counters)
+    {
+        spinningWorkerCount_.fetch_add(1, std::memory_order_seq_cst);
+        for (size_t i = 0; i < options_.spinCount + options_.yieldCount; ++i) {
+            if (taskCount_.load(std::memory_order_seq_cst) != 0 || !isRunning_.load(std::memory_order_relaxed)) {
+                break;
+            }
+            if (i < options_.spinCount) {
+                internal::CpuRelax();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+
+        std::unique_lock<std::mutex> lck(queueMutex_);
+        spinningWorkerCount_.fetch_sub(1, std::memory_order_relaxed);
+        while (taskCount_.load(std::memory_order_relaxed) == 0 && isRunning_) {
+            ++parkedWorkerCount_;
+            auto status = queueCv_.wait_for(lck, options_.idleTimeout);
+            --parkedWorkerCount_;
+            if (status == std::cv_status::timeout && taskCount_.load(std::memory_order_relaxed) == 0 && isRunning_
+                && threadCount_ > options_.minThreads) {
+                // Shrink, the thread is joined by the others
+                --threadCount_;
+                exitedThreads_.splice(exitedThreads_.end(), workerThreads_, self);
+                workerCounters_.Retire(counters);
+                return {};
+            }
+        }
+        if (!isRunning_ && taskCount_.load(std::memory_order_relaxed) == 0) {
+            return {};
+        }
+        CountOutTask();
+        return PopTask(counters);
+    }
+
+    /// Should be called with queueMutex_ locked, and taskCount_ > 0
+    void CountOutTask()
+    {
+        size_t taskCount = taskCount_.load(std::memory_order_relaxed) - 1;
+        taskCount_.store(taskCount, std::memory_order_relaxed);
+        if (blockedProducerCount_ != 0) {
+            // The producers may wait for different room
+            notFullCv_.notify_all();
+        }
+        if (isHighWatermarkReached_ && taskCount <= options_.highWatermark / 2) {
+            isHighWatermarkReached_ = false;
+        }
+    }
+
+    /// Takes the newest task for a helping wait (see TryRunOne), the highest priority first, if it's deeper than the waiting one.
+    /// The newest one is likely a child of the waiting task, like the LIFO pop of a work stealing deque, so the nested waits are about as deep as the task tree.
+    /// Should be called with queueMutex_ locked, the task should be counted out of taskCount_ if it returns true
+    bool PopNewestTask(QueuedTask& task)
+    {
+        for (auto& queue : taskQueues_) {
+            if (!queue.empty() && queue.back().depth > internal::tTaskDepth) {
+                task = std::move(queue.back());
+                queue.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Should be called with queueMutex_ locked, and the task is counted out of taskCount_
+    QueuedTask PopTask(internal::WorkerCounters* counters)
+    {
+        // A starving lane is served first, the lowest priority first
+        size_t lane = kNumberOfTaskPriorities;
+        for (size_t i = kNumberOfTaskPriorities; i-- > 0;) {
+            if (!taskQueues_[i].empty() && skipCounts_[i] >= kMaxSkipCount) {
+                lane = i;
+                break;
+            }
+        }
+        if (lane == kNumberOfTaskPriorities) {
+            lane = 0;
+            while (taskQueues_[lane].empty()) {
+                ++lane;
+            }
+            assert(lane < kNumberOfTaskPriorities);
+            for (size_t i = lane + 1; i < kNumberOfTaskPriorities; ++i) {
+                if (!taskQueues_[i].empty()) {
+                    ++skipCounts_[i];
                 }
-                functor = taskQueue_.front();
-                --taskCount_;
-                taskQueue_.pop();
             }
-            assert(functor != nullptr);
-            functor();
         }
+        skipCounts_[lane] = 0;
+        auto& front = taskQueues_[lane].front();
+#if defined(TPL_ENABLE_STATS)
+        counters->RecordQueueWait(front.stamp);
+#else
+        (void)counters;
+#endif
+        auto task = std::move(front);
+        taskQueues_[lane].pop_front();
+        return task;
     }
 
 private:
-    std::vector<std::thread> workerThreads_ {};
+    Options options_;
+
+    std::list<std::thread> workerThreads_ {};
+    // The workers that exited since the pool shrank, not joined yet
+    std::list<std::thread> exitedThreads_ {};
+    size_t threadCount_ { 0 };
+
+    // The concurrent queues, one for each priority, guarded by queueMutex_
+    std::deque<QueuedTask> taskQueues_[kNumberOfTaskPriorities] {};
+    size_t skipCounts_[kNumberOfTaskPriorities] {};
+    size_t parkedWorkerCount_ { 0 };
+    size_t blockedProducerCount_ { 0 };
+    bool isHighWatermarkReached_ { false };
+    internal::WorkerCountersList workerCounters_ {};
 
-    // The concurrent queue
-    std::queue<std::function<void()>> taskQueue_ {};
-    size_t taskCount_ { 0 };
-    std::mutex queueMutex_ {};
+    ITaskAllocator* taskAllocator_ { nullptr };
+
+    // The lock is written by every producer and consumer
+    alignas(internal::kCacheLineSize) mutable std::mutex queueMutex_ {};
     std::condition_variable queueCv_ {};
+    std::condition_variable notFullCv_ {};
+
+    // Modified with queueMutex_ locked, polled by the spinning workers without the lock
+    alignas(internal::kCacheLineSize) std::atomic<size_t> taskCount_ { 0 };
+    std::atomic_bool isRunning_ { false };
 
-    bool isRunning_ { false };
+    // Modified by the workers starting and stopping spinning, without the lock
+    alignas(internal::kCacheLineSize) std::atomic<size_t> spinningWorkerCount_ { 0 };
 };
 
 extern ITaskScheduler* gDefaultTaskScheduler;
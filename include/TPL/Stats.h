@@ -0,0 +1,294 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/Platform.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <vector>
+
+// The instrumentation is compiled only if TPL_ENABLE_STATS is defined (the TPL_ENABLE_STATS cmake option),
+// otherwise the hooks are empty inline functions, and the snapshots are empty
+
+namespace tpl {
+
+/// Bucket i counts the durations in [2^i, 2^(i+1)) nanoseconds, bucket 0 also counts 0, and the last bucket counts all the longer ones
+struct LatencyHistogram {
+    static constexpr size_t kNumberOfBuckets = 40; // About 18 minutes
+
+    std::array<uint64_t, kNumberOfBuckets> buckets {};
+    uint64_t count { 0 };
+    uint64_t totalNanoseconds { 0 };
+
+    static size_t GetBucket(uint64_t nanoseconds)
+    {
+        size_t bucket = 0;
+        for (uint64_t n = nanoseconds >> 1; n != 0 && bucket + 1 < kNumberOfBuckets; n >>= 1) {
+            ++bucket;
+        }
+        return bucket;
+    }
+
+    void Record(uint64_t nanoseconds)
+    {
+        ++buckets[GetBucket(nanoseconds)];
+        ++count;
+        totalNanoseconds += nanoseconds;
+    }
+
+    void Merge(const LatencyHistogram& other)
+    {
+        for (size_t i = 0; i < kNumberOfBuckets; ++i) {
+            buckets[i] += other.buckets[i];
+        }
+        count += other.count;
+        totalNanoseconds += other.totalNanoseconds;
+    }
+
+    /// The upper bound of the bucket where the percentile (in [0, 1]) falls, or 0 if there is no sample
+    uint64_t GetPercentileNanoseconds(double percentile) const
+    {
+        if (count == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(percentile * static_cast<double>(count - 1));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kNumberOfBuckets; ++i) {
+            seen += buckets[i];
+            if (seen > rank) {
+                return (uint64_t { 2 } << i) - 1;
+            }
+        }
+        return UINT64_MAX;
+    }
+};
+
+struct WorkerStats {
+    uint64_t executedCount { 0 };
+    uint64_t stolenCount { 0 }; // Only counted by the work stealing schedulers
+    uint64_t idleNanoseconds { 0 };
+    LatencyHistogram queueWait {}; // From being scheduled to being taken by the worker
+    LatencyHistogram run {};
+
+    void Merge(const WorkerStats& other)
+    {
+        executedCount += other.executedCount;
+        stolenCount += other.stolenCount;
+        idleNanoseconds += other.idleNanoseconds;
+        queueWait.Merge(other.queueWait);
+        run.Merge(other.run);
+    }
+};
+
+struct SchedulerStats {
+    /// False if the stats are not compiled in, or the scheduler is not instrumented
+    bool isEnabled { false };
+    /// The number of the tasks scheduled but not taken by any worker yet
+    size_t queueDepth { 0 };
+    /// The live workers
+    std::vector<WorkerStats> workers {};
+    /// All the workers, including the exited ones
+    WorkerStats total {};
+};
+
+struct TaskNameStats {
+    std::string name {};
+    LatencyHistogram run {};
+};
+
+/// The run time of the named tasks (see Task::SetName) can be aggregated per name,
+/// which takes a global lock per task run, so it is disabled by default
+void EnableTaskNameStats(bool enable);
+
+/// In the order of names
+std::vector<TaskNameStats> GetTaskNameStats();
+
+void ResetTaskNameStats();
+
+namespace internal {
+
+#if defined(TPL_ENABLE_STATS)
+    using StatsClock = std::chrono::steady_clock;
+    using StatsTimePoint = StatsClock::time_point;
+
+    inline StatsTimePoint StatsNow() { return StatsClock::now(); }
+
+    inline uint64_t NanosecondsSince(StatsTimePoint start)
+    {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(StatsClock::now() - start).count();
+        return elapsed > 0 ? static_cast<uint64_t>(elapsed) : 0;
+    }
+
+    /// Each counter is written by one thread, so they are updated with relaxed load and store instead of read-modify-write
+    inline void AddRelaxed(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    class AtomicHistogram {
+    public:
+        void Record(uint64_t nanoseconds)
+        {
+            AddRelaxed(buckets_[LatencyHistogram::GetBucket(nanoseconds)], 1);
+            AddRelaxed(count_, 1);
+            AddRelaxed(totalNanoseconds_, nanoseconds);
+        }
+
+        void Snapshot(LatencyHistogram& histogram) const
+        {
+            for (size_t i = 0; i < LatencyHistogram::kNumberOfBuckets; ++i) {
+                histogram.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+            }
+            histogram.count = count_.load(std::memory_order_relaxed);
+            histogram.totalNanoseconds = totalNanoseconds_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::array<std::atomic<uint64_t>, LatencyHistogram::kNumberOfBuckets> buckets_ {};
+        std::atomic<uint64_t> count_ { 0 };
+        std::atomic<uint64_t> totalNanoseconds_ { 0 };
+    };
+
+    /// Stamped when the task is queued
+    struct EnqueueStamp {
+        StatsTimePoint time { StatsNow() };
+    };
+
+    /// The counters of a worker, which are only written by the worker itself
+    class alignas(kCacheLineSize) WorkerCounters {
+    public:
+        void RecordRun(StatsTimePoint start)
+        {
+            run_.Record(NanosecondsSince(start));
+            AddRelaxed(executedCount_, 1);
+        }
+
+        void RecordQueueWait(const EnqueueStamp& stamp) { queueWait_.Record(NanosecondsSince(stamp.time)); }
+
+        void RecordIdle(StatsTimePoint start) { AddRelaxed(idleNanoseconds_, NanosecondsSince(start)); }
+
+        void RecordStolen() { AddRelaxed(stolenCount_, 1); }
+
+        WorkerStats Snapshot() const
+        {
+            WorkerStats stats;
+            stats.executedCount = executedCount_.load(std::memory_order_relaxed);
+            stats.stolenCount = stolenCount_.load(std::memory_order_relaxed);
+            stats.idleNanoseconds = idleNanoseconds_.load(std::memory_order_relaxed);
+            queueWait_.Snapshot(stats.queueWait);
+            run_.Snapshot(stats.run);
+            return stats;
+        }
+
+    private:
+        std::atomic<uint64_t> executedCount_ { 0 };
+        std::atomic<uint64_t> stolenCount_ { 0 };
+        std::atomic<uint64_t> idleNanoseconds_ { 0 };
+        AtomicHistogram queueWait_ {};
+        AtomicHistogram run_ {};
+    };
+
+    /// The counters of the workers of an elastic pool, the counters of the exited workers are merged into one.
+    /// The caller should synchronize Add, Retire and Snapshot
+    class WorkerCountersList {
+    public:
+        WorkerCounters* Add() { return &*list_.emplace(list_.end()); }
+
+        void Retire(WorkerCounters* counters)
+        {
+            for (auto it = list_.begin(); it != list_.end(); ++it) {
+                if (&*it == counters) {
+                    retired_.Merge(it->Snapshot());
+                    list_.erase(it);
+                    return;
+                }
+            }
+        }
+
+        void Snapshot(SchedulerStats& stats) const
+        {
+            stats.isEnabled = true;
+            stats.total = retired_;
+            for (auto& counters : list_) {
+                stats.workers.push_back(counters.Snapshot());
+                stats.total.Merge(stats.workers.back());
+            }
+        }
+
+    private:
+        std::list<WorkerCounters> list_ {};
+        WorkerStats retired_ {};
+    };
+
+    bool IsTaskNameStatsEnabled();
+
+    void RecordTaskRun(const std::string& name, uint64_t nanoseconds);
+
+    /// Records the run time of a named task in its destructor, if the per name stats are enabled
+    class TaskNameTimer {
+    public:
+        explicit TaskNameTimer(const std::string& name)
+            : name_ { name.empty() || !IsTaskNameStatsEnabled() ? nullptr : &name }
+        {
+            if (name_ != nullptr) {
+                start_ = StatsNow();
+            }
+        }
+
+        TaskNameTimer(const TaskNameTimer&) = delete;
+        TaskNameTimer& operator=(const TaskNameTimer&) = delete;
+
+        ~TaskNameTimer()
+        {
+            if (name_ != nullptr) {
+                RecordTaskRun(*name_, NanosecondsSince(start_));
+            }
+        }
+
+    private:
+        const std::string* name_;
+        StatsTimePoint start_ {};
+    };
+#else
+    struct StatsTimePoint {
+    };
+
+    inline StatsTimePoint StatsNow() { return {}; }
+
+    struct EnqueueStamp {
+    };
+
+    class WorkerCounters {
+    public:
+        void RecordRun(StatsTimePoint) { }
+
+        void RecordQueueWait(const EnqueueStamp&) { }
+
+        void RecordIdle(StatsTimePoint) { }
+
+        void RecordStolen() { }
+    };
+
+    class WorkerCountersList {
+    public:
+        WorkerCounters* Add() { return &counters_; }
+
+        void Retire(WorkerCounters*) { }
+
+        void Snapshot(SchedulerStats&) const { }
+
+    private:
+        WorkerCounters counters_ {};
+    };
+#endif
+
+}
+
+}
@@ -4,7 +4,25 @@
 
 #pragma once
 
+#include "Algorithm.h"
+#include "Cancellation.h"
+#include "Channel.h"
+#include "Coroutine.h"
+#include "InlineScheduler.h"
+#include "IoReactor.h"
+#include "ManualScheduler.h"
+#include "MpscQueue.h"
+#include "Pipeline.h"
 #include "RefCntAutoPtr.h"
 #include "RefCounted.h"
 #include "Scheduler.h"
-#include "Task.h"
\ No newline at end of file
+#include "Stats.h"
+#include "TaskAllocator.h"
+#include "TaskGraph.h"
+#include "Task.h"
+#include "Timer.h"
+#include "TimerWheel.h"
+#include "Tracing.h"
+#include "UniqueFunction.h"
+#include "When.h"
+#include "WorkStealingScheduler.h"
\ No newline at end of file
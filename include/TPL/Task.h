@@ -4,12 +4,24 @@
 
 #pragma once
 
+#include "TPL/Cancellation.h"
 #include "TPL/Future.h"
 #include "TPL/RefCntAutoPtr.h"
 #include "TPL/RefCounted.h"
+#include "TPL/Scheduler.h"
+#include "TPL/TaskAllocator.h"
+#include "TPL/TimerWheel.h"
+#include "TPL/Tracing.h"
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
 #include <type_traits>
-
-// TODO: Introduce concept if compiled with C++20
+#include <utility>
+#include <vector>
 
 namespace tpl {
 
@@ -17,8 +29,46 @@ namespace internal {
     template <class T>
     class TaskImpl;
 
+    class TaskBatch;
+
+    extern thread_local int tInlineContinuationDepth;
 }
 
+template <class T>
+class Task;
+
+namespace internal {
+    /// Creates a started task with no functor, the value of which should be set manually via its future
+    template <class T>
+    Task<T> MakeProxyTask(ITaskScheduler& scheduler);
+}
+
+enum class ContinuationPolicy : uint8_t {
+    kSchedule, // Schedule the task once its parents are ready
+    kInline, // Run the task directly in the thread that makes its last parent ready, if the thread is a worker of the task's scheduler
+};
+
+enum class TaskPlacement : uint8_t {
+    kScheduler, // Run the task in its scheduler
+    kNearParent, // Run the continuation in the scheduler of the worker thread that makes its last parent ready, e.g. the same NUMA node
+};
+
+/// The max nested depth of the inlined continuations in a thread, the continuations are scheduled instead if exceeded
+constexpr int kMaxInlineContinuationDepth = 32;
+
+struct TaskOptions {
+    ContinuationPolicy continuationPolicy { ContinuationPolicy::kSchedule };
+    /// Passed to the scheduler via ScheduleOptions
+    TaskPriority priority { TaskPriority::kNormal };
+    /// Only applies to the tasks with parents, a task started by Start always runs in its scheduler
+    TaskPlacement placement { TaskPlacement::kScheduler };
+    /// Once the cancellation is requested, the task is completed as canceled instead of being run if it's not running yet
+    CancellationToken cancellationToken {};
+    /// A lazy task is not started until it is demanded, i.e. it's started, waited or listened (by a child, WhenAll, co_await etc.),
+    /// and a lazy child demands its parents in turn. The branches never demanded are released without being run
+    bool isLazy { false };
+};
+
 template <class T>
 class Task {
     static_assert(std::is_same_v<T, std::decay_t<T>>, "The parameter of Task class should be a type name with no qualifier");
@@ -35,6 +85,9 @@ public:
     template <class Functor, class... ParentTasks>
     Task(Functor&& functor, ITaskScheduler& scheduler, const ParentTasks&... parentTasks);
 
+    template <class Functor, class... ParentTasks>
+    Task(Functor&& functor, ITaskScheduler& scheduler, const TaskOptions& options, const ParentTasks&... parentTasks);
+
     Task& operator=(const Task&) = default;
 
     Task& operator=(Task&&) noexcept = default;
@@ -49,6 +102,10 @@ public:
 
     auto& GetFuture() const;
 
+    /// Waits and moves the value out of the future, see Future::TakeValue.
+    /// NOTE: Only for the case that the caller is the only consumer of the value
+    auto TakeValue();
+
     ITaskScheduler* GetScheduler() const;
 
     const std::string& GetName() const;
@@ -57,9 +114,16 @@ public:
 
     void SetName(std::string&& name);
 
+    /// NOTE: Should be set before the parents of this task are started
+    void SetContinuationPolicy(ContinuationPolicy policy);
+
+    /// NOTE: The new task shares the cancellation token and the priority of this task
     template <class Functor>
     auto Then(Functor&& functor, ITaskScheduler* scheduler = nullptr);
 
+    template <class Functor>
+    auto Then(Functor&& functor, const TaskOptions& options, ITaskScheduler* scheduler = nullptr);
+
     /// Unwrap function create a proxy task that represents asynchronous operation of Task<Task<T>>.
     /// i.e. A Task<Task<T>>::Unrap returns a Task<T> object
     /// If scheduler == nullptr, then the default scheduler will be set
@@ -68,6 +132,11 @@ public:
     /// Note: this the new task will use the scheduler of this task
     auto Unwrap() -> ValueType;
 
+    /// Creates a proxy task which is completed as this task, or faulted with TaskTimeoutException if this task isn't ready after timeout.
+    /// The timeout is a timer of TimerWheel::GetDefault, no thread is blocked. This task is not affected by the timeout,
+    /// its value is forwarded without being copied, so the proxy task keeps this task alive.
+    Task<T> WithTimeout(std::chrono::nanoseconds timeout) const;
+
 #if !defined(NDEBUG)
 private:
     void MarkAsStarted();
@@ -81,16 +150,35 @@ private:
 
     template <class ImplType>
     friend Task<typename ImplType::ValueType> MakeTaskFromImpl(ImplType* impl);
+
+    friend class internal::TaskBatch;
+
+    template <class U>
+    friend Task<U> internal::MakeProxyTask(ITaskScheduler& scheduler);
 };
 
 template <class Functor, class... ParentTasks>
 inline auto MakeTask(Functor&& functor, ITaskScheduler* scheduler, const ParentTasks&... parentTasks);
 
+template <class Functor, class... ParentTasks>
+inline auto MakeTask(Functor&& functor, ITaskScheduler* scheduler, const TaskOptions& options, const ParentTasks&... parentTasks);
+
 template <class Functor>
 inline auto MakeTaskAndStart(Functor&& functor, ITaskScheduler* scheduler);
 
 template <class ValueType>
 inline auto MakeTaskFromValue(ValueType&& value, ITaskScheduler* scheduler);
+
+/// Makes one task for each item of range, the task invokes functor(item). The returned tasks are not started.
+template <class Range, class Functor>
+inline auto MakeTasks(const Range& range, Functor&& functor, ITaskScheduler* scheduler);
+
+/// Starts all the tasks with ITaskScheduler::ScheduleBatch, one batch for each scheduler
+template <class... Tasks>
+inline void StartAll(const Tasks&... tasks);
+
+template <class T>
+inline void StartAll(const std::vector<Task<T>>& tasks);
 }
 
 #include "Task.inl"
\ No newline at end of file
@@ -10,43 +10,21 @@ namespace tpl {
 
 //====== TaskImpl
 
-namespace detail {
-
-    template <int n, class Arg, class... Args>
-    inline auto&& NthArg(Arg&& arg, Args&&... args)
-    {
-        if constexpr (n == 0) {
-            return arg;
-        } else {
-            return NthArg<n - 1, Args...>(std::forward<Args>(args)...);
-        }
-    }
+namespace internal {
 
-    template <class Tuple, typename T, T... S, typename F, class... Args>
-    inline constexpr void ForTupleAndArgs(Tuple& tuple, std::integer_sequence<T, S...>, F&& f, Args&&... args)
-    {
-        (void)std::vector<bool> { (static_cast<void>(f(std::get<std::integral_constant<T, S>::value>(tuple), NthArg<std::integral_constant<T, S>::value>(args...))), true)... };
-    }
+    template <class Impl, class... Args>
+    inline Impl* NewTaskImpl(ITaskScheduler& scheduler, Args&&... args);
 
-    template <class Tuple, class T, T... S, class F>
-    inline constexpr auto InvokeFunctionWithTuple(Tuple& tuple, std::integer_sequence<T, S...>, F&& functor)
-    {
-        return functor(MakeTaskFromImpl(std::get<std::integral_constant<T, S>::value>(tuple).Get())...);
-    }
-}
-
-namespace internal {
+    template <class Impl>
+    inline void DeleteTaskImpl(Impl* impl);
 
     template <class T>
-    class TaskImpl final : public RefCounted {
+    class TaskImpl : public RefCounted, public HelpHandler {
     public:
         using ValueType = T;
 
-        template <class Functor>
-        TaskImpl(Functor&& functor, ITaskScheduler& scheduler);
-
-        template <class Functor, class... ParentTasks>
-        TaskImpl(Functor&& functor, ITaskScheduler& scheduler, ParentTasks*... parentTasks);
+        /// Creates a task which has no functor, i.e. a proxy task or a task from value, the future of which will be set manually.
+        explicit TaskImpl(ITaskScheduler& scheduler);
 
         TaskImpl(const TaskImpl&) = delete;
         TaskImpl(TaskImpl&&) = delete;
@@ -57,17 +35,76 @@ namespace internal {
         TaskImpl& operator=(TaskImpl&&) = delete;
 
     public:
+        /// Demands the task if it's lazy, otherwise schedules it
         void Start();
 
+        /// Defers starting the task until its future is demanded, i.e. someone listens to it or starts it
+        void MakeLazy()
+        {
+            isLazy_ = true;
+            future_.SetDemandHandler(new Activator(this));
+        }
+
+        bool IsLazy() const { return isLazy_; }
+
+        /// Marks the task as started, and returns the functor to be scheduled to scheduler.
+        /// The functor runs the task unless a helping wait claims it first, see TryRunInWait
+        UniqueFunction<void()> CreateRunner(ITaskScheduler& scheduler);
+
+        /// Runs the queued task in a helping wait for its future, nested in the waiting one like a functor taken from the queue
+        bool TryRunInWait(ITaskScheduler& scheduler) final;
+
         auto& GetFuture() const { return future_; }
 
         ITaskScheduler* GetScheduler() const { return scheduler_; }
 
-        const std::string& GetName() const { return name_; }
+        const std::string& GetName() const { return name_ != nullptr ? *name_ : EmptyName(); }
+
+        void SetName(const std::string& name) { SetName(std::string(name)); }
+
+        void SetName(std::string&& name)
+        {
+            if (name_ == nullptr) {
+                name_ = std::make_unique<std::string>(std::move(name));
+            } else {
+                *name_ = std::move(name);
+            }
+        }
+
+        void SetContinuationPolicy(ContinuationPolicy policy) { continuationPolicy_ = policy; }
+
+        void SetPlacement(TaskPlacement placement) { placement_ = placement; }
+
+        TaskPriority GetPriority() const { return priority_; }
 
-        void SetName(const std::string& name) { name_ = name; }
+        void SetPriority(TaskPriority priority) { priority_ = priority; }
 
-        void SetName(std::string&& name) { name_ = std::move(name); }
+        const CancellationToken& GetCancellationToken() const { return cancellationToken_; }
+
+        void SetCancellationToken(const CancellationToken& token) { cancellationToken_ = token; }
+
+#if defined(TPL_ENABLE_TRACING)
+        uint64_t GetTraceId() const { return traceId_; }
+#endif
+
+        /// Starts the task once the parents are ready, according to the continuation policy and the placement
+        void StartAsContinuation();
+
+        /// Completes the task as canceled without running it, e.g. its token is canceled
+        void CompleteAsCanceled();
+
+        /// Faults the task with the exception (i.e. TaskRejectedException) of the scheduler which rejects the runner,
+        /// unless a helping wait has claimed the runner already
+        void CompleteAsRejected(std::exception_ptr exception)
+        {
+            if (Claim()) {
+                Fault(std::move(exception));
+            }
+        }
+
+        /// Completes the task without running it, since one of its parents is canceled or faulted.
+        /// The task is canceled, or faulted with the same exception
+        void CompleteAsFailed(const FutureBase& failedParent);
 
 #if !defined(NDEBUG)
     private:
@@ -81,147 +118,739 @@ namespace internal {
 #endif
 
     protected:
-        Future<ValueType> future_ {};
-        std::function<ValueType()> functor_ { nullptr };
-        ITaskScheduler* scheduler_ { nullptr };
-        std::string name_ {};
+        /// Invokes the functor and sets the value of future_, executed by the scheduler.
+        /// The functor should be invoked via InvokeFunctorGuarded, and future_ completed outside of it
+        virtual void Run();
+
+        /// Invokes f, which invokes the functor, returns false if it throws, and the task is canceled or faulted then.
+        /// Only the functor is guarded, so the listeners invoked by completing future_ never fault a completed future
+        template <class F>
+        bool InvokeFunctorGuarded(F&& f)
+        {
+            try {
+                f();
+                return true;
+            } catch (const TaskCanceledException&) {
+                // Thrown by CancellationToken::ThrowIfCancellationRequested, or by getting the value of a canceled task
+                Cancel();
+            } catch (...) {
+                Fault(std::current_exception());
+            }
+            return false;
+        }
+
+        /// Releases what is held for running the task, e.g. the references of the parents.
+        /// Called before the task is completed without a value
+        virtual void ReleaseDependencies() { }
+
+        /// Called once a lazy task is demanded, starts the task by default
+        virtual void Activate() { StartIn(*scheduler_); }
+
+        void DeleteSelf() override { DeleteTaskImpl(this); }
+
+    private:
+        /// A rejected task is faulted with TaskRejectedException, instead of throwing it to the caller, which may be a listener of the parents
+        void StartIn(ITaskScheduler& scheduler, bool isContinuation = false);
+
+        /// Runs the task unless the cancellation is requested, the exception thrown by the functor is stored in future_ (see InvokeFunctorGuarded)
+        void Execute();
+
+        /// Either the queued runner or a helping wait runs the task, the one that loses does nothing
+        bool Claim()
+        {
+            return !isClaimed_.exchange(true, std::memory_order_acq_rel);
+        }
+
+        void Cancel()
+        {
+            ReleaseDependencies();
+            future_.SetCanceled();
+        }
+
+        void Fault(std::exception_ptr exception)
+        {
+            ReleaseDependencies();
+            future_.SetException(std::move(exception));
+        }
+
+        static const std::string& EmptyName()
+        {
+            static const std::string empty {};
+            return empty;
+        }
+
+        /// Only allocated for the lazy tasks, the caller demanding the future holds a reference of the owner
+        struct Activator final : DemandHandler {
+            explicit Activator(TaskImpl* o)
+                : owner { o }
+            {
+            }
+
+            void OnDemand() override { owner->Activate(); }
+
+            void Destroy() override { delete this; }
+
+            TaskImpl* owner;
+        };
+
+    protected:
+        // The options are one byte each, and fill the padding after the reference count.
+        // The fields before future_ are written before the task is started, and only read afterwards
+        ContinuationPolicy continuationPolicy_ { ContinuationPolicy::kSchedule };
+        TaskPlacement placement_ { TaskPlacement::kScheduler };
+        TaskPriority priority_ { TaskPriority::kNormal };
+        bool isLazy_ { false };
 #if !defined(NDEBUG)
         bool isStarted_ { false };
 #endif
+        ITaskScheduler* scheduler_ { nullptr };
+        ITaskAllocator* allocator_ { nullptr };
+        CancellationToken cancellationToken_ {};
+        // Most tasks have no name, so it's out of line
+        std::unique_ptr<std::string> name_ {};
+#if defined(TPL_ENABLE_TRACING)
+        uint64_t traceId_ { NewTraceId() };
+#endif
+        // Written before the runner is queued, and read by the helping waits, see TryRunInWait
+        ITaskScheduler* queuedScheduler_ { nullptr };
+        uint32_t queuedDepth_ { 0 };
+        std::atomic_bool isClaimed_ { false };
+        // Written by the threads adding listeners and completing the task, placed last to be away from the fields above
+        Future<ValueType> future_ {};
 
         template <class U>
         friend class TaksImpl;
+
+        template <class Impl, class... Args>
+        friend Impl* NewTaskImpl(ITaskScheduler& scheduler, Args&&... args);
+
+        template <class Impl>
+        friend void DeleteTaskImpl(Impl* impl);
+    };
+
+    /// A task with no parent, the functor is stored in the same block with the task.
+    template <class T, class Functor>
+    class FunctorTaskImpl final : public TaskImpl<T> {
+    public:
+        using ValueType = T;
+
+        template <class F>
+        FunctorTaskImpl(F&& functor, ITaskScheduler& scheduler)
+            : TaskImpl<T>(scheduler)
+            , functor_ { std::forward<F>(functor) }
+        {
+            static_assert(std::is_invocable_r_v<ValueType, Functor>);
+        }
+
+    protected:
+        void Run() override
+        {
+            if constexpr (std::is_same_v<void, ValueType>) {
+                if (this->InvokeFunctorGuarded(functor_)) {
+                    this->future_.SetValue();
+                }
+            } else {
+                std::optional<ValueType> value {};
+                if (this->InvokeFunctorGuarded([this, &value]() { value.emplace(functor_()); })) {
+                    this->future_.SetValue(std::move(*value));
+                }
+            }
+        }
+
+        void DeleteSelf() override { DeleteTaskImpl(this); }
+
+    private:
+        Functor functor_;
+    };
+
+    /// A listener that is embedded in the dependent task, one for each parent.
+    /// When the parent becomes ready, it takes a reference of the parent, and notifies the owner.
+    /// The listener holds a reference of the owner, which is released in Destroy.
+    template <class Owner, size_t Index, class ParentTask>
+    struct DependencySlot : FutureListener {
+        void Invoke(const FutureBase&) final
+        {
+            // The parent may lose all the other references after the listener is called, keep it valid until the owner is done.
+            // It's also the argument passed to the functor by reference, so invoking the functor touches no reference count
+            parentTask = MakeTaskFromImpl(parent);
+            static_cast<Owner*>(this)->OnDependencyReady();
+        }
+
+        void Destroy() final
+        {
+            static_cast<Owner*>(this)->Release();
+        }
+
+        ParentTask* parent { nullptr };
+        Task<typename ParentTask::ValueType> parentTask {};
+    };
+
+    template <class T, class Functor, class IndexSequence, class... ParentTasks>
+    class DependentTaskImpl;
+
+    /// A task with parents, the functor, the dependency counter and the listeners of the parents are stored in the same block with the task.
+    template <class T, class Functor, size_t... Indices, class... ParentTasks>
+    class DependentTaskImpl<T, Functor, std::index_sequence<Indices...>, ParentTasks...> final
+        : public TaskImpl<T>
+        , public DependencySlot<DependentTaskImpl<T, Functor, std::index_sequence<Indices...>, ParentTasks...>, Indices, ParentTasks>... {
+        using Self = DependentTaskImpl<T, Functor, std::index_sequence<Indices...>, ParentTasks...>;
+
+        template <size_t Index, class ParentTask>
+        using Slot = DependencySlot<Self, Index, ParentTask>;
+
+    public:
+        using ValueType = T;
+
+        template <class F>
+        DependentTaskImpl(F&& functor, ITaskScheduler& scheduler)
+            : TaskImpl<T>(scheduler)
+            , functor_ { std::forward<F>(functor) }
+        {
+            static_assert(std::is_invocable_r_v<ValueType, Functor, const Task<typename ParentTasks::ValueType>&...>);
+        }
+
+        /// Registers the listeners to the parents, should be called after someone holds a reference of this task,
+        /// since the parents may be ready already, and this task may be scheduled and released before this function returns.
+        /// A lazy task only keeps the parents alive here, and registers the listeners once it is demanded,
+        /// which demands the lazy parents in turn.
+        void Connect(ParentTasks*... parentTasks)
+        {
+            ((static_cast<Slot<Indices, ParentTasks>*>(this)->parent = parentTasks), ...);
+#if defined(TPL_ENABLE_TRACING)
+            (TraceDependency(parentTasks->GetTraceId(), this->GetTraceId()), ...);
+#endif
+            if (this->IsLazy()) {
+                ((static_cast<Slot<Indices, ParentTasks>*>(this)->parentTask = MakeTaskFromImpl(parentTasks)), ...);
+                return;
+            }
+            (ConnectTo<Indices, ParentTasks>(), ...);
+        }
+
+        void OnDependencyReady()
+        {
+            if (pendingDependencyCount_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                if (const FutureBase* failedParent = FindFailedParent()) {
+                    // Never scheduled
+                    this->CompleteAsFailed(*failedParent);
+                } else {
+                    this->StartAsContinuation();
+                }
+            }
+        }
+
+    protected:
+        void Run() override
+        {
+            if constexpr (std::is_same_v<void, ValueType>) {
+                if (this->InvokeFunctorGuarded([this]() { InvokeFunctor(); })) {
+                    ReleaseDependencies();
+                    this->future_.SetValue();
+                }
+            } else {
+                std::optional<ValueType> value {};
+                if (this->InvokeFunctorGuarded([this, &value]() { value.emplace(InvokeFunctor()); })) {
+                    ReleaseDependencies();
+                    this->future_.SetValue(std::move(*value));
+                }
+            }
+        }
+
+        void ReleaseDependencies() override
+        {
+            ((static_cast<Slot<Indices, ParentTasks>*>(this)->parentTask = Task<typename ParentTasks::ValueType> {}), ...);
+        }
+
+        void Activate() override { (ConnectTo<Indices, ParentTasks>(), ...); }
+
+        void DeleteSelf() override { DeleteTaskImpl(this); }
+
+    private:
+        template <size_t Index, class ParentTask>
+        void ConnectTo()
+        {
+            auto* slot = static_cast<Slot<Index, ParentTask>*>(this);
+            // Released in DependencySlot::Destroy
+            this->AddRef();
+            slot->parent->GetFuture().AddListener(slot);
+        }
+
+        auto InvokeFunctor()
+        {
+            return functor_(static_cast<const Slot<Indices, ParentTasks>*>(this)->parentTask...);
+        }
+
+        /// Returns the future of the first parent which is canceled or faulted, or nullptr if all the parents have values
+        const FutureBase* FindFailedParent() const
+        {
+            const FutureBase* result { nullptr };
+            ((result = (result == nullptr && !static_cast<const Slot<Indices, ParentTasks>*>(this)->parent->GetFuture().HasValue())
+                     ? &static_cast<const Slot<Indices, ParentTasks>*>(this)->parent->GetFuture()
+                     : result),
+                ...);
+            return result;
+        }
+
+    private:
+        Functor functor_;
+        std::atomic_int pendingDependencyCount_ { static_cast<int>(sizeof...(ParentTasks)) };
+    };
+
+    /// A listener that is embedded in the owner task, it dispatches to Owner::OnReady(future, Tag).
+    /// The listener holds a reference of the owner, which is released in Destroy.
+    template <class Owner, class Tag>
+    struct EmbeddedListener : FutureListener {
+        void Invoke(const FutureBase& future) final
+        {
+            static_cast<Owner*>(this)->OnReady(future, Tag {});
+        }
+
+        void Destroy() final
+        {
+            static_cast<Owner*>(this)->Release();
+        }
+    };
+
+    struct OuterTaskTag {
+    };
+
+    struct InnerTaskTag {
+    };
+
+    struct InputTaskTag {
+    };
+
+    /// The proxy task of Task::WithTimeout, which races the input task with a timer, the first one completes this task.
+    /// It's the listener of the input task, and it cancels the timer if the input wins, so nothing is held until the deadline
+    template <class T>
+    class TimeoutTaskImpl final
+        : public TaskImpl<T>
+        , public EmbeddedListener<TimeoutTaskImpl<T>, InputTaskTag> {
+        using InputListener = EmbeddedListener<TimeoutTaskImpl<T>, InputTaskTag>;
+
+    public:
+        using ValueType = T;
+
+        explicit TimeoutTaskImpl(ITaskScheduler& scheduler)
+            : TaskImpl<T>(scheduler)
+        {
+        }
+
+        /// Should be called after someone holds a reference of this task
+        void Connect(const Task<T>& input, std::chrono::nanoseconds timeout)
+        {
+            // Set before the timer, which may fire at once
+            input_ = input;
+            timer_ = TimerWheel::GetDefault().Add(timeout, UniqueFunction<void()>([self = RefCntAutoPtr(this)]() { self->OnTimeout(); }));
+            // Released in InputListener::Destroy
+            this->AddRef();
+            input.GetFuture().AddListener(static_cast<InputListener*>(this));
+        }
+
+        void OnReady(const FutureBase& base, InputTaskTag)
+        {
+            if (isDone_.exchange(true, std::memory_order_acq_rel)) {
+                return;
+            }
+            TimerWheel::GetDefault().Cancel(timer_);
+            auto& future = static_cast<const Future<T>&>(base);
+            if (future.IsFaulted()) {
+                this->future_.SetException(future.GetException());
+            } else if (!future.HasValue()) {
+                this->future_.SetCanceled();
+            } else if constexpr (std::is_same_v<void, T>) {
+                this->future_.SetValue();
+            } else {
+                // The value is not copied, input_ is kept until this task is destroyed
+                this->future_.SetForwardedValue(future.GetValue());
+                return;
+            }
+            input_ = Task<T> {};
+        }
+
+    protected:
+        void DeleteSelf() override { DeleteTaskImpl(this); }
+
+    private:
+        void OnTimeout()
+        {
+            if (!isDone_.exchange(true, std::memory_order_acq_rel)) {
+                this->future_.SetException(std::make_exception_ptr(TaskTimeoutException()));
+                // The input may never complete, its listener holds this task
+                input_ = Task<T> {};
+            }
+        }
+
+    private:
+        Task<T> input_ {};
+        TimerWheel::TimerId timer_ { 0 };
+        std::atomic_bool isDone_ { false };
+    };
+
+    /// The proxy task of Task<Task<T>>::Unwrap, the listeners of the outer task and the inner task are stored in the same block.
+    template <class T>
+    class UnwrapTaskImpl final
+        : public TaskImpl<T>
+        , public EmbeddedListener<UnwrapTaskImpl<T>, OuterTaskTag>
+        , public EmbeddedListener<UnwrapTaskImpl<T>, InnerTaskTag> {
+        using OuterListener = EmbeddedListener<UnwrapTaskImpl<T>, OuterTaskTag>;
+        using InnerListener = EmbeddedListener<UnwrapTaskImpl<T>, InnerTaskTag>;
+
+    public:
+        using ValueType = T;
+        using InnerTask = Task<T>;
+
+        explicit UnwrapTaskImpl(ITaskScheduler& scheduler)
+            : TaskImpl<T>(scheduler)
+        {
+        }
+
+        void Connect(const Future<InnerTask>& outerFuture)
+        {
+            // Released in OuterListener::Destroy
+            this->AddRef();
+            outerFuture.AddListener(static_cast<OuterListener*>(this));
+        }
+
+        void OnReady(const FutureBase& future, OuterTaskTag)
+        {
+            if (!future.HasValue()) {
+                SetFailed(future);
+                return;
+            }
+            innerTask_ = static_cast<const Future<InnerTask>&>(future).GetValue();
+            // Released in InnerListener::Destroy
+            this->AddRef();
+            innerTask_.GetFuture().AddListener(static_cast<InnerListener*>(this));
+        }
+
+        void OnReady(const FutureBase& future, InnerTaskTag)
+        {
+            if (!future.HasValue()) {
+                SetFailed(future);
+                innerTask_ = InnerTask {};
+                return;
+            }
+            if constexpr (std::is_same_v<void, ValueType>) {
+                this->future_.SetValue();
+                innerTask_ = InnerTask {};
+            } else {
+                // The value is not copied, innerTask_ is kept until this task is destroyed
+                this->future_.SetForwardedValue(static_cast<const Future<ValueType>&>(future).GetValue());
+            }
+        }
+
+    protected:
+        void DeleteSelf() override { DeleteTaskImpl(this); }
+
+    private:
+        void SetFailed(const FutureBase& future)
+        {
+            if (future.IsFaulted()) {
+                this->future_.SetException(future.GetException());
+            } else {
+                this->future_.SetCanceled();
+            }
+        }
+
+    private:
+        InnerTask innerTask_ {};
     };
 
     template <class Functor, class... ParentTasks>
-    inline auto MakeTaskImpl(Functor&& functor, ITaskScheduler& scheduler, ParentTasks*... parentTasks);
+    inline auto MakeTaskImpl(Functor&& functor, ITaskScheduler& scheduler, const TaskOptions& options, ParentTasks*... parentTasks);
+
+    /// Creates a task block with the allocator of scheduler
+    template <class Impl, class... Args>
+    inline Impl* NewTaskImpl(ITaskScheduler& scheduler, Args&&... args)
+    {
+        ITaskAllocator* allocator = scheduler.GetTaskAllocator();
+        if (allocator == nullptr) {
+            return new Impl(std::forward<Args>(args)...);
+        }
+        void* memory = allocator->Allocate(sizeof(Impl), alignof(Impl));
+        Impl* impl = new (memory) Impl(std::forward<Args>(args)...);
+        impl->allocator_ = allocator;
+        return impl;
+    }
+
+    /// Impl should be the most derived type of the task block
+    template <class Impl>
+    inline void DeleteTaskImpl(Impl* impl)
+    {
+        ITaskAllocator* allocator = impl->allocator_;
+        if (allocator == nullptr) {
+            delete impl;
+            return;
+        }
+        impl->~Impl();
+        allocator->Deallocate(impl, sizeof(Impl), alignof(Impl));
+    }
 
     template <class T>
-    template <class Functor>
-    inline TaskImpl<T>::TaskImpl(Functor&& functor, ITaskScheduler& scheduler)
-        : functor_ { std::forward<Functor>(functor) }
-        , scheduler_ { &scheduler }
+    inline TaskImpl<T>::TaskImpl(ITaskScheduler& scheduler)
+        : scheduler_ { &scheduler }
     {
-        static_assert(std::is_invocable_r_v<ValueType, Functor>);
     }
 
     template <class T>
-    template <class Functor, class... ParentTasks>
-    inline TaskImpl<T>::TaskImpl(Functor&& functor, ITaskScheduler& scheduler, ParentTasks*... parentTasks)
-        : functor_ { nullptr }
-        , scheduler_ { &scheduler }
+    inline TaskImpl<T>::~TaskImpl()
     {
-        static_assert(std::is_invocable_r_v<ValueType, Functor, Task<typename ParentTasks::ValueType>...>);
-        constexpr auto kNumberOfParents = sizeof...(ParentTasks);
+    }
 
-        using TupleType = std::tuple<RefCntAutoPtr<ParentTasks>...>;
+    template <class T>
+    inline void TaskImpl<T>::Run()
+    {
+        assert(false); // A task with no functor should never be scheduled
+    }
 
-        struct DependencyContext {
-            std::atomic_int pendingDependencyCount { 0 };
-            TupleType dependencies {};
-        };
+    template <class T>
+    inline void TaskImpl<T>::Start()
+    {
+        if (isLazy_) {
+            // Started by Activate, at most once however many times it's demanded
+            future_.Demand();
+            return;
+        }
+        StartIn(*scheduler_);
+    }
 
-        auto spDeps = std::make_shared<DependencyContext>();
-        spDeps->pendingDependencyCount = kNumberOfParents;
+    template <class T>
+    inline void TaskImpl<T>::StartIn(ITaskScheduler& scheduler, bool isContinuation)
+    {
+        if (cancellationToken_.IsCancellationRequested()) {
+            CompleteAsCanceled();
+            return;
+        }
+        try {
+            scheduler.Schedule(CreateRunner(scheduler), ScheduleOptions { priority_, isContinuation });
+        } catch (const TaskRejectedException&) {
+            CompleteAsRejected(std::current_exception());
+        }
+    }
 
-        // NOTE: Don't pass spDeps, or deps will always keeps it's deps references.
-        functor_ = [deps = spDeps.get(), functor = std::forward<Functor>(functor)]() -> ValueType {
-            return detail::InvokeFunctionWithTuple(deps->dependencies, std::make_index_sequence<sizeof...(ParentTasks)> {}, functor);
-        };
+    template <class T>
+    inline void TaskImpl<T>::CompleteAsCanceled()
+    {
+#if !defined(NDEBUG)
+        MarkAsStarted();
+#endif
+        Cancel();
+    }
 
-        detail::ForTupleAndArgs(
-            spDeps->dependencies,
-            std::make_index_sequence<kNumberOfParents> {},
-            [spDeps, this](auto& tupleEle, auto* parent) {
-                using ParentTaskType = std::decay_t<decltype(*parent)>;
-                if constexpr (std::is_same_v<typename ParentTaskType::ValueType, void>) {
-                    parent->GetFuture().InvokeOnValueAvailable([spDeps, &tupleEle, parent, self = RefCntAutoPtr(this)]() {
-                        // Since this callback will be destroyed after is is called,
-
-                        // i.e. self's parent may lose all the references, let's add an reference to keep self's parent valid
-                        tupleEle = parent;
-
-                        if (--spDeps->pendingDependencyCount == 0) {
-                            // do nothing, just keep spDeps(i.e. it's parents) not being destoryed, spDeps will be released after self becomes ready
-                            if constexpr (std::is_same_v<ValueType, void>) {
-                                self->future_.InvokeOnValueAvailable([spDeps]() {});
-                            } else {
-                                self->future_.InvokeOnValueAvailable([spDeps](const auto&) {});
-                            }
-                            // i.e. The reference count of self will be released,
-                            // but we schedule self before returning
-                            // thus the background worker task a reference of self
-                            self->Start();
-                        }
-                    });
-                } else {
-                    parent->GetFuture().InvokeOnValueAvailable([spDeps, &tupleEle, parent, self = RefCntAutoPtr(this)](const typename ParentTaskType::ValueType& v) {
-                        // See above
-                        tupleEle = parent;
-
-                        if (--spDeps->pendingDependencyCount == 0) {
-                            // see above
-                            if constexpr (std::is_same_v<ValueType, void>) {
-                                self->future_.InvokeOnValueAvailable([spDeps]() {});
-                            } else {
-                                self->future_.InvokeOnValueAvailable([spDeps](const auto&) {});
-                            }
-                            // See above
-                            self->Start();
-                        }
-                    });
-                }
-            },
-            parentTasks...);
+    template <class T>
+    inline void TaskImpl<T>::CompleteAsFailed(const FutureBase& failedParent)
+    {
+#if !defined(NDEBUG)
+        MarkAsStarted();
+#endif
+        if (failedParent.IsFaulted()) {
+            Fault(failedParent.GetException());
+        } else {
+            Cancel();
+        }
     }
 
     template <class T>
-    inline TaskImpl<T>::~TaskImpl()
+    inline void TaskImpl<T>::Execute()
     {
+        // The token may be canceled while the task is queued
+        if (cancellationToken_.IsCancellationRequested()) {
+            Cancel();
+            return;
+        }
+#if defined(TPL_ENABLE_STATS)
+        TaskNameTimer timer(GetName());
+#endif
+#if defined(TPL_ENABLE_TRACING)
+        TaskTraceScope traceScope(traceId_, GetName());
+#endif
+        Run();
     }
 
     template <class T>
-    inline void TaskImpl<T>::Start()
+    inline UniqueFunction<void()> TaskImpl<T>::CreateRunner(ITaskScheduler& scheduler)
     {
 #if !defined(NDEBUG)
         MarkAsStarted();
 #endif
-        scheduler_->Schedule([self = RefCntAutoPtr(this)]() mutable {
-            if constexpr (std::is_same_v<void, ValueType>) {
-                self->functor_();
-                self->future_.SetValue();
-            } else {
-                self->future_.SetValue(self->functor_());
+#if defined(TPL_ENABLE_TRACING)
+        TraceSchedule(traceId_, GetName());
+#endif
+        // The same depth as the schedulers stamp the runner with
+        queuedScheduler_ = &scheduler;
+        queuedDepth_ = tTaskDepth + 1;
+        future_.SetHelpHandler(this);
+        return UniqueFunction<void()>([self = RefCntAutoPtr(this)]() mutable {
+            if (self->Claim()) {
+                self->Execute();
             }
         });
     }
 
+    template <class T>
+    inline bool TaskImpl<T>::TryRunInWait(ITaskScheduler& scheduler)
+    {
+        if (queuedScheduler_ != &scheduler || !CanHelpAwaited(queuedDepth_) || isClaimed_.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        // The queued runner may be dropped by the worker losing the claim while the task runs here
+        RefCntAutoPtr<TaskImpl> self(this);
+        if (!Claim()) {
+            return false;
+        }
+        TaskDepthScope depth(queuedDepth_);
+        Execute();
+        return true;
+    }
+
+    template <class T>
+    inline void TaskImpl<T>::StartAsContinuation()
+    {
+        // GetScheduler still returns scheduler_, the placement only decides where this run goes
+        ITaskScheduler* current = GetCurrentTaskScheduler();
+        ITaskScheduler* target = placement_ == TaskPlacement::kNearParent && current != nullptr ? current : scheduler_;
+        if (continuationPolicy_ == ContinuationPolicy::kInline && current == target
+            && tInlineContinuationDepth < kMaxInlineContinuationDepth) {
+#if !defined(NDEBUG)
+            MarkAsStarted();
+#endif
+            // The caller (i.e. the listener of the last parent) holds a reference of this task until Run returns
+            ++tInlineContinuationDepth;
+            Execute();
+            --tInlineContinuationDepth;
+        } else {
+            StartIn(*target, true);
+        }
+    }
+
     template <class Functor, class... ParentTasks>
-    inline auto MakeTaskImpl(Functor&& functor, ITaskScheduler& scheduler, ParentTasks*... parentTasks)
+    inline auto MakeTaskImpl(Functor&& functor, ITaskScheduler& scheduler, const TaskOptions& options, ParentTasks*... parentTasks)
     {
         using ValueType = decltype(functor(MakeTaskFromImpl(parentTasks)...));
-        using ResultTaskType = TaskImpl<ValueType>;
-        return RefCntAutoPtr<ResultTaskType>(new ResultTaskType(std::forward<Functor>(functor), scheduler, parentTasks...));
+        using FunctorType = std::decay_t<Functor>;
+        if constexpr (sizeof...(ParentTasks) == 0) {
+            using ResultTaskType = FunctorTaskImpl<ValueType, FunctorType>;
+            RefCntAutoPtr<TaskImpl<ValueType>> result(NewTaskImpl<ResultTaskType>(scheduler, std::forward<Functor>(functor), scheduler));
+            result->SetContinuationPolicy(options.continuationPolicy);
+            result->SetPriority(options.priority);
+            result->SetCancellationToken(options.cancellationToken);
+            if (options.isLazy) {
+                result->MakeLazy();
+            }
+            return result;
+        } else {
+            using ResultTaskType = DependentTaskImpl<ValueType, FunctorType, std::index_sequence_for<ParentTasks...>, ParentTasks...>;
+            auto* impl = NewTaskImpl<ResultTaskType>(scheduler, std::forward<Functor>(functor), scheduler);
+            RefCntAutoPtr<TaskImpl<ValueType>> result(impl);
+            // The options should be applied before connecting, since the parents may be ready already
+            impl->SetContinuationPolicy(options.continuationPolicy);
+            impl->SetPriority(options.priority);
+            impl->SetPlacement(options.placement);
+            impl->SetCancellationToken(options.cancellationToken);
+            if (options.isLazy) {
+                impl->MakeLazy();
+            }
+            impl->Connect(parentTasks...);
+            return result;
+        }
     }
 
+    template <class T>
+    inline auto MakeProxyTaskImpl(ITaskScheduler& scheduler)
+    {
+        return RefCntAutoPtr<TaskImpl<T>>(NewTaskImpl<TaskImpl<T>>(scheduler, scheduler));
+    }
+
+    /// Collects the tasks to start, and schedules them with one ScheduleBatch call per scheduler and priority
+    class TaskBatch {
+    public:
+        template <class T>
+        void Add(const Task<T>& task)
+        {
+            auto* impl = task.impl_.Get();
+            assert(impl != nullptr);
+            if (impl->IsLazy()) {
+                // Not batched, since it may be demanded concurrently
+                impl->Start();
+                return;
+            }
+            if (impl->GetCancellationToken().IsCancellationRequested()) {
+                impl->CompleteAsCanceled();
+                return;
+            }
+            ITaskScheduler* scheduler = impl->GetScheduler();
+            TaskPriority priority = impl->GetPriority();
+            auto it = std::find_if(batches_.begin(), batches_.end(), [scheduler, priority](const Batch& batch) {
+                return batch.scheduler == scheduler && batch.priority == priority;
+            });
+            if (it == batches_.end()) {
+                batches_.push_back(Batch { scheduler, priority, {}, {} });
+                it = batches_.end() - 1;
+            }
+            it->functors.push_back(impl->CreateRunner(*scheduler));
+            it->rejecters.push_back(Rejecter { impl, [](RefCounted* t, std::exception_ptr e) {
+                                                  static_cast<TaskImpl<T>*>(t)->CompleteAsRejected(std::move(e));
+                                              } });
+        }
+
+        void Submit()
+        {
+            for (auto& batch : batches_) {
+                try {
+                    batch.scheduler->ScheduleBatch(batch.functors.data(), batch.functors.size(), ScheduleOptions { batch.priority });
+                } catch (const TaskRejectedException&) {
+                    // The functors taken by the scheduler are moved, the rest are faulted, they are kept alive by their runners
+                    for (size_t i = 0; i < batch.functors.size(); ++i) {
+                        if (batch.functors[i]) {
+                            batch.rejecters[i].reject(batch.rejecters[i].task, std::current_exception());
+                        }
+                    }
+                }
+            }
+            batches_.clear();
+        }
+
+    private:
+        struct Rejecter {
+            RefCounted* task;
+            void (*reject)(RefCounted* task, std::exception_ptr exception);
+        };
+
+        struct Batch {
+            ITaskScheduler* scheduler;
+            TaskPriority priority;
+            std::vector<UniqueFunction<void()>> functors;
+            std::vector<Rejecter> rejecters;
+        };
+
+        std::vector<Batch> batches_ {};
+    };
+
 }
 
 //========== Task
 template <class T>
 template <class Functor, class... ParentTasks>
 inline Task<T>::Task(Functor&& functor, ITaskScheduler& scheduler, const ParentTasks&... parentTasks)
+    : Task(std::forward<Functor>(functor), scheduler, TaskOptions {}, parentTasks...)
+{
+}
+
+template <class T>
+template <class Functor, class... ParentTasks>
+inline Task<T>::Task(Functor&& functor, ITaskScheduler& scheduler, const TaskOptions& options, const ParentTasks&... parentTasks)
     : impl_ { nullptr }
 {
     // The `Functor` is a value
     if constexpr (std::is_same_v<std::decay_t<Functor>, ValueType>) {
         static_assert(sizeof...(ParentTasks) == 0, "Make task from value should have no parent task");
-        impl_ = internal::MakeTaskImpl(std::function<ValueType()>(nullptr), scheduler);
+        impl_ = internal::MakeProxyTaskImpl<ValueType>(scheduler);
 #if !defined(NDEBUG)
         MarkAsStarted();
 #endif
         const_cast<Future<ValueType>&>(GetFuture()).SetValue(std::forward<Functor>(functor));
     } else {
-        impl_ = internal::MakeTaskImpl(std::forward<Functor>(functor), scheduler, parentTasks.impl_.Get()...);
+        impl_ = internal::MakeTaskImpl(std::forward<Functor>(functor), scheduler, options, parentTasks.impl_.Get()...);
     }
 }
 
@@ -237,6 +866,13 @@ inline void Task<T>::Start() { impl_->Start(); }
 template <class T>
 inline auto& Task<T>::GetFuture() const { return impl_->GetFuture(); }
 
+template <class T>
+inline auto Task<T>::TakeValue()
+{
+    static_assert(!std::is_same_v<void, ValueType>, "Task<void> has no value to take");
+    return const_cast<Future<ValueType>&>(GetFuture()).TakeValue();
+}
+
 template <class T>
 inline const std::string& Task<T>::GetName() const { return impl_->GetName(); }
 
@@ -246,6 +882,9 @@ inline void Task<T>::SetName(const std::string& name) { impl_->SetName(name); }
 template <class T>
 inline void Task<T>::SetName(std::string&& name) { impl_->SetName(std::move(name)); }
 
+template <class T>
+inline void Task<T>::SetContinuationPolicy(ContinuationPolicy policy) { impl_->SetContinuationPolicy(policy); }
+
 template <class T>
 inline Task<T>::Task(internal::TaskImpl<T>* impl)
     : impl_(impl)
@@ -259,7 +898,20 @@ inline auto Task<T>::Then(Functor&& functor, ITaskScheduler* scheduler)
     if (scheduler == nullptr) {
         scheduler = GetScheduler();
     }
-    return MakeTask(functor, scheduler, *this);
+    TaskOptions options;
+    options.priority = impl_->GetPriority();
+    options.cancellationToken = impl_->GetCancellationToken();
+    return MakeTask(std::forward<Functor>(functor), scheduler, options, *this);
+}
+
+template <class T>
+template <class Functor>
+inline auto Task<T>::Then(Functor&& functor, const TaskOptions& options, ITaskScheduler* scheduler)
+{
+    if (scheduler == nullptr) {
+        scheduler = GetScheduler();
+    }
+    return MakeTask(std::forward<Functor>(functor), scheduler, options, *this);
 }
 
 template <class T>
@@ -272,17 +924,14 @@ inline auto Task<T>::Unwrap(ITaskScheduler* scheduler) -> ValueType
         scheduler = gDefaultTaskScheduler;
         assert(scheduler != nullptr); // "Did you forget to specify a scheduler?"
     }
-    using CallbackType = std::function<UnwrappedValueType()>;
-    UnwrappedTask proxyTask(CallbackType(nullptr), *scheduler); // This task will actually not be executed, so just keep the callback null
+    // This task will actually not be executed, its value is set once the inner task is ready
+    auto* impl = internal::NewTaskImpl<internal::UnwrapTaskImpl<UnwrappedValueType>>(*scheduler, *scheduler);
+    UnwrappedTask proxyTask(impl);
 #if !defined(NDEBUG)
     proxyTask.MarkAsStarted();
 #endif
     // Here, this.future_ can't be a future of void
-    GetFuture().InvokeOnValueAvailable([proxyTask](const UnwrappedTask& innerTask) {
-        innerTask.GetFuture().InvokeOnValueAvailable([proxyTask](const UnwrappedValueType& value) {
-            const_cast<Future<UnwrappedValueType>&>(proxyTask.GetFuture()).SetValue(value);
-        });
-    });
+    impl->Connect(GetFuture());
     return proxyTask;
 }
 
@@ -292,6 +941,20 @@ inline auto Task<T>::Unwrap() -> ValueType
     return Unwrap(GetScheduler());
 }
 
+template <class T>
+inline Task<T> Task<T>::WithTimeout(std::chrono::nanoseconds timeout) const
+{
+    auto* scheduler = GetScheduler();
+    // This task will actually not be executed, it's completed by the input task or the timer
+    auto* impl = internal::NewTaskImpl<internal::TimeoutTaskImpl<T>>(*scheduler, *scheduler);
+    Task<T> result(impl);
+#if !defined(NDEBUG)
+    result.MarkAsStarted();
+#endif
+    impl->Connect(*this, timeout);
+    return result;
+}
+
 #if !defined(NDEBUG)
 template <class T>
 inline void tpl::Task<T>::MarkAsStarted()
@@ -308,6 +971,12 @@ inline ITaskScheduler* Task<T>::GetScheduler() const
 
 template <class Functor, class... ParentTasks>
 inline auto MakeTask(Functor&& functor, ITaskScheduler* scheduler, const ParentTasks&... parentTasks)
+{
+    return MakeTask(std::forward<Functor>(functor), scheduler, TaskOptions {}, parentTasks...);
+}
+
+template <class Functor, class... ParentTasks>
+inline auto MakeTask(Functor&& functor, ITaskScheduler* scheduler, const TaskOptions& options, const ParentTasks&... parentTasks)
 {
     using ValueType = decltype(functor(parentTasks...));
     using ResultTaskType = Task<ValueType>;
@@ -315,7 +984,7 @@ inline auto MakeTask(Functor&& functor, ITaskScheduler* scheduler, const ParentT
         scheduler = gDefaultTaskScheduler;
         assert(scheduler != nullptr); // "Did you forget to specify a scheduler?"
     }
-    return ResultTaskType(functor, *scheduler, parentTasks...);
+    return ResultTaskType(std::forward<Functor>(functor), *scheduler, options, parentTasks...);
 }
 
 template <class Functor>
@@ -344,4 +1013,49 @@ inline Task<typename ImplType::ValueType> MakeTaskFromImpl(ImplType* impl)
     return Task<ValueType>(impl);
 }
 
+namespace internal {
+    template <class T>
+    inline Task<T> MakeProxyTask(ITaskScheduler& scheduler)
+    {
+        // Adopts the reference instead of taking a new one
+        Task<T> task;
+        task.impl_ = MakeProxyTaskImpl<T>(scheduler);
+#if !defined(NDEBUG)
+        task.MarkAsStarted();
+#endif
+        return task;
+    }
+}
+
+template <class Range, class Functor>
+inline auto MakeTasks(const Range& range, Functor&& functor, ITaskScheduler* scheduler)
+{
+    using ItemType = std::decay_t<decltype(*std::begin(range))>;
+    using ValueType = decltype(functor(std::declval<const ItemType&>()));
+    std::vector<Task<ValueType>> tasks;
+    tasks.reserve(static_cast<size_t>(std::distance(std::begin(range), std::end(range))));
+    for (const auto& item : range) {
+        tasks.push_back(MakeTask([functor, item]() mutable { return functor(item); }, scheduler));
+    }
+    return tasks;
+}
+
+template <class... Tasks>
+inline void StartAll(const Tasks&... tasks)
+{
+    internal::TaskBatch batch;
+    (batch.Add(tasks), ...);
+    batch.Submit();
+}
+
+template <class T>
+inline void StartAll(const std::vector<Task<T>>& tasks)
+{
+    internal::TaskBatch batch;
+    for (const auto& task : tasks) {
+        batch.Add(task);
+    }
+    batch.Submit();
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,142 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace tpl {
+
+/// The allocator of the task objects.
+/// A scheduler may provide an allocator (see ITaskScheduler::GetTaskAllocator), then all the tasks created with the scheduler are allocated from it.
+class ITaskAllocator {
+public:
+    virtual ~ITaskAllocator() = default;
+
+    virtual void* Allocate(size_t size, size_t alignment) = 0;
+
+    /// NOTE: The memory may be deallocated in a thread other than the one it is allocated
+    virtual void Deallocate(void* ptr, size_t size, size_t alignment) = 0;
+};
+
+/// A pool allocator with size classes.
+/// Each thread has its own free lists, so allocating and deallocating in the same thread takes no lock.
+/// Memory deallocated in another thread is pushed to a lock-free list of the owner thread, which is reclaimed when the owner runs out of free blocks.
+class PoolTaskAllocator final : public ITaskAllocator {
+public:
+    static PoolTaskAllocator& Get();
+
+    PoolTaskAllocator(PoolTaskAllocator&&) = delete;
+    PoolTaskAllocator(const PoolTaskAllocator&) = delete;
+    PoolTaskAllocator& operator=(PoolTaskAllocator&&) = delete;
+    PoolTaskAllocator& operator=(const PoolTaskAllocator&) = delete;
+
+    void* Allocate(size_t size, size_t alignment) final;
+
+    void Deallocate(void* ptr, size_t size, size_t alignment) final;
+
+private:
+    PoolTaskAllocator() = default;
+
+    ~PoolTaskAllocator() final = default;
+};
+
+/// An arena allocator for frame-scoped task graphs.
+/// Deallocate does nothing, the whole memory is reclaimed at once by Reset.
+class ArenaTaskAllocator final : public ITaskAllocator {
+public:
+    explicit ArenaTaskAllocator(size_t chunkSize = 64 * 1024)
+        : chunkSize_ { chunkSize }
+    {
+        assert(chunkSize > 0);
+    }
+
+    ArenaTaskAllocator(ArenaTaskAllocator&&) = delete;
+    ArenaTaskAllocator(const ArenaTaskAllocator&) = delete;
+    ArenaTaskAllocator& operator=(ArenaTaskAllocator&&) = delete;
+    ArenaTaskAllocator& operator=(const ArenaTaskAllocator&) = delete;
+
+    ~ArenaTaskAllocator() final
+    {
+        for (auto& chunk : chunks_) {
+            ::operator delete(chunk.memory);
+        }
+    }
+
+    void* Allocate(size_t size, size_t alignment) final
+    {
+        std::unique_lock<std::mutex> lck(mutex_);
+        liveCount_.fetch_add(1, std::memory_order_relaxed);
+        if (!chunks_.empty()) {
+            if (void* ptr = chunks_.back().Allocate(size, alignment)) {
+                return ptr;
+            }
+        }
+        chunks_.push_back(Chunk::Create(std::max(chunkSize_, size + alignment)));
+        void* ptr = chunks_.back().Allocate(size, alignment);
+        assert(ptr != nullptr);
+        return ptr;
+    }
+
+    void Deallocate(void*, size_t, size_t) final
+    {
+        liveCount_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /// Frees all the memory at once, the first chunk is kept for reuse.
+    /// NOTE: All the tasks allocated from this arena should be already destroyed
+    void Reset()
+    {
+        std::unique_lock<std::mutex> lck(mutex_);
+        assert(liveCount_.load(std::memory_order_relaxed) == 0);
+        if (chunks_.empty()) {
+            return;
+        }
+        for (size_t i = 1; i < chunks_.size(); ++i) {
+            ::operator delete(chunks_[i].memory);
+        }
+        chunks_.resize(1);
+        chunks_[0].used = 0;
+    }
+
+    /// The number of the allocations which are not deallocated yet
+    size_t GetLiveCount() const { return liveCount_.load(std::memory_order_relaxed); }
+
+private:
+    struct Chunk {
+        static Chunk Create(size_t size)
+        {
+            return Chunk { static_cast<char*>(::operator new(size)), size, 0 };
+        }
+
+        void* Allocate(size_t size, size_t alignment)
+        {
+            auto address = reinterpret_cast<uintptr_t>(memory) + used;
+            size_t padding = (alignment - address % alignment) % alignment;
+            if (used + padding + size > capacity) {
+                return nullptr;
+            }
+            void* ptr = memory + used + padding;
+            used += padding + size;
+            return ptr;
+        }
+
+        char* memory;
+        size_t capacity;
+        size_t used;
+    };
+
+    size_t chunkSize_;
+    std::vector<Chunk> chunks_ {};
+    std::mutex mutex_ {};
+    std::atomic<size_t> liveCount_ { 0 };
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,100 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/Task.h"
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tpl {
+
+/// A static graph of functors, which is built once and run many times, e.g. a per frame pipeline.
+/// The topology is flattened into arrays by Build, a run only resets the dependency counters:
+/// no task object is created for the nodes and no listener is registered, the returned task is the only allocation of a run.
+/// A node runs once all its predecessors are done, the last ready successor of a node runs in the same thread without being scheduled.
+/// If a functor throws, the nodes not started yet are skipped, and the returned task is faulted with the first exception
+/// (or canceled, if it's a TaskCanceledException). If a root is rejected by a bounded scheduler, the run is faulted with TaskRejectedException.
+/// NOTE: The graph should not be modified or destroyed while running, and should not be run again until the returned task is ready
+class TaskGraph {
+public:
+    using NodeId = size_t;
+
+    TaskGraph() = default;
+
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph(TaskGraph&&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+    TaskGraph& operator=(TaskGraph&&) = delete;
+
+    ~TaskGraph();
+
+    /// The functor is invoked once per run
+    template <class Functor>
+    NodeId AddNode(Functor&& functor, std::string name = {})
+    {
+        return AddNodeInternal(UniqueFunction<void()>(std::forward<Functor>(functor)), std::move(name));
+    }
+
+    /// to runs after from
+    void AddEdge(NodeId from, NodeId to);
+
+    size_t GetNodeCount() const { return functors_.size(); }
+
+    /// Precomputes the arrays for running, returns false if the graph has a cycle.
+    /// Called by Run if the graph is modified since the last build
+    bool Build();
+
+    /// Returns a task which is ready once all the nodes are done, or faulted with a std::logic_error if the graph has a cycle.
+    /// If scheduler == nullptr, the default scheduler will be used
+    Task<void> Run(ITaskScheduler* scheduler = nullptr, TaskPriority priority = TaskPriority::kNormal);
+
+private:
+    static constexpr NodeId kNoNode = ~NodeId { 0 };
+
+    NodeId AddNodeInternal(UniqueFunction<void()>&& functor, std::string&& name);
+
+    /// The successors are scheduled as continuations, so a bounded scheduler never rejects them.
+    /// A rejected node faults the run, and is skipped in the calling thread
+    void ScheduleNode(NodeId node, bool isContinuation);
+
+    /// Runs node, then the ready successors in the same thread one by one
+    void ExecuteNode(NodeId node);
+
+    void RunNode(NodeId node);
+
+    void Complete();
+
+private:
+    // What's added
+    std::vector<UniqueFunction<void()>> functors_ {};
+    std::vector<std::string> names_ {};
+    std::vector<std::pair<NodeId, NodeId>> edges_ {};
+
+    // The successors of node i are successors_[successorOffsets_[i], successorOffsets_[i + 1])
+    std::vector<size_t> successorOffsets_ {};
+    std::vector<NodeId> successors_ {};
+    std::vector<uint32_t> inDegrees_ {};
+    std::vector<NodeId> roots_ {};
+    bool isBuilt_ { false };
+    bool isCyclic_ { false };
+#if defined(TPL_ENABLE_TRACING)
+    std::vector<uint64_t> traceIds_ {};
+#endif
+
+    // The state of the current run
+    std::unique_ptr<std::atomic<uint32_t>[]> pendingCounts_ {};
+    std::atomic<size_t> remainingCount_ { 0 };
+    std::atomic_bool hasException_ { false };
+    std::exception_ptr exception_ { nullptr };
+    ITaskScheduler* scheduler_ { nullptr };
+    TaskPriority priority_ { TaskPriority::kNormal };
+    Task<void> result_ {};
+    std::atomic_bool isRunning_ { false };
+};
+
+}
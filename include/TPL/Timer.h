@@ -0,0 +1,108 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/Algorithm.h"
+#include "TPL/Task.h"
+#include "TPL/TimerWheel.h"
+#include <chrono>
+#include <utility>
+
+namespace tpl {
+
+namespace internal {
+
+    /// The state of MakePeriodicTask, it re-arms its timer after each run, at a fixed rate: the n-th run is due at start + n * period,
+    /// a run which is late doesn't make the next ones late, and the runs never overlap
+    template <class Functor>
+    class PeriodicTaskState final : public RefCounted {
+    public:
+        template <class F>
+        PeriodicTaskState(F&& functor, ITaskScheduler& scheduler, std::chrono::nanoseconds period, TaskPriority priority, CancellationToken token)
+            : functor_ { std::forward<F>(functor) }
+            , result_ { MakeProxyTask<void>(scheduler) }
+            , scheduler_ { &scheduler }
+            , period_ { std::max(period, std::chrono::nanoseconds(1)) }
+            , priority_ { priority }
+            , token_ { std::move(token) }
+            , dueTime_ { TimerWheel::Clock::now() }
+        {
+        }
+
+        const Task<void>& GetResult() const { return result_; }
+
+        void Arm()
+        {
+            dueTime_ += period_;
+            auto delay = std::max<TimerWheel::Clock::duration>(dueTime_ - TimerWheel::Clock::now(), TimerWheel::Clock::duration::zero());
+            TimerWheel::GetDefault().Add(delay, UniqueFunction<void()>([self = RefCntAutoPtr(this)]() { self->OnTimer(); }));
+        }
+
+    private:
+        Future<void>& GetResultFuture() { return const_cast<Future<void>&>(result_.GetFuture()); }
+
+        void OnTimer()
+        {
+            if (token_.IsCancellationRequested()) {
+                GetResultFuture().SetCanceled();
+                return;
+            }
+            scheduler_->Schedule(UniqueFunction<void()>([self = RefCntAutoPtr(this)]() { self->Run(); }), ScheduleOptions { priority_, true });
+        }
+
+        void Run()
+        {
+            try {
+                functor_();
+            } catch (...) {
+                SetFailed(GetResultFuture(), std::current_exception());
+                return;
+            }
+            if (token_.IsCancellationRequested()) {
+                GetResultFuture().SetCanceled();
+                return;
+            }
+            Arm();
+        }
+
+    private:
+        Functor functor_;
+        Task<void> result_;
+        ITaskScheduler* scheduler_;
+        std::chrono::nanoseconds period_;
+        TaskPriority priority_;
+        CancellationToken token_;
+        TimerWheel::Clock::time_point dueTime_;
+    };
+
+}
+
+/// Creates a task which is started after delay, by a timer of TimerWheel::GetDefault.
+/// The task is a continuation of the timer, so a bounded scheduler never blocks the timer thread with it.
+/// NOTE: The returned task should not be started manually
+template <class Functor>
+inline auto MakeDelayedTask(std::chrono::nanoseconds delay, Functor&& functor, ITaskScheduler* scheduler = nullptr, const TaskOptions& options = TaskOptions {})
+{
+    auto& sched = internal::ResolveScheduler(scheduler);
+    auto timer = internal::MakeProxyTask<void>(sched);
+    auto task = MakeTask([functor = std::forward<Functor>(functor)](const Task<void>&) mutable { return functor(); }, &sched, options, timer);
+    TimerWheel::GetDefault().Add(delay, UniqueFunction<void()>([timer]() { const_cast<Future<void>&>(timer.GetFuture()).SetValue(); }));
+    return task;
+}
+
+/// Invokes functor() every period in scheduler, the first time is after one period.
+/// The returned task is completed as canceled at the first due time after the cancellation of options.cancellationToken is requested,
+/// or with the exception thrown by functor, which stops the later runs.
+/// NOTE: Without a cancellation token, the task runs until the process exits
+template <class Functor>
+inline Task<void> MakePeriodicTask(std::chrono::nanoseconds period, Functor&& functor, ITaskScheduler* scheduler = nullptr, const TaskOptions& options = TaskOptions {})
+{
+    using StateType = internal::PeriodicTaskState<std::decay_t<Functor>>;
+    RefCntAutoPtr<StateType> state(new StateType(std::forward<Functor>(functor), internal::ResolveScheduler(scheduler), period, options.priority, options.cancellationToken));
+    state->Arm();
+    return state->GetResult();
+}
+
+}
@@ -0,0 +1,93 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/UniqueFunction.h"
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace tpl {
+
+/// A hierarchical timer wheel serviced by one thread: kNumLevels levels of kNumSlots slots, the ticks of level n are kNumSlots^n times longer.
+/// Adding and canceling a timer are O(1), a timer is moved to the lower level once its slot of the higher level comes up.
+/// The callbacks run in the timer thread, so they should be short, e.g. starting a task or completing a future.
+/// A timer never fires before its deadline, and may fire up to one tick (kTickDuration) later.
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+    using TimerId = uint64_t;
+
+    static constexpr std::chrono::milliseconds kTickDuration { 1 };
+    static constexpr size_t kNumSlotBits = 8;
+    static constexpr size_t kNumSlots = size_t(1) << kNumSlotBits;
+    static constexpr size_t kNumLevels = 4;
+
+    TimerWheel();
+
+    TimerWheel(TimerWheel&&) = delete;
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(TimerWheel&&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    /// The pending timers are destroyed without being fired
+    ~TimerWheel();
+
+    /// The wheel used by MakeDelayedTask, MakePeriodicTask and Task::WithTimeout, which is created on demand
+    static TimerWheel& GetDefault();
+
+    /// Fires callback after delay, the returned id is never 0
+    TimerId Add(Clock::duration delay, UniqueFunction<void()>&& callback);
+
+    /// Returns false if the timer has fired (or is firing) already, or it's canceled already
+    bool Cancel(TimerId id);
+
+    size_t GetPendingCount() const;
+
+private:
+    struct Timer {
+        TimerId id { 0 };
+        uint64_t deadline { 0 }; // In ticks
+        UniqueFunction<void()> callback {};
+        Timer* prev { nullptr };
+        Timer* next { nullptr };
+        Timer** slot { nullptr };
+    };
+
+    uint64_t ToTick(Clock::time_point time) const;
+
+    Clock::time_point ToTime(uint64_t tick) const;
+
+    void Insert(Timer* timer);
+
+    static void Unlink(Timer* timer);
+
+    /// Advances currentTick_ to tick, the expired timers are moved to expired
+    void Advance(uint64_t tick, std::vector<Timer*>& expired);
+
+    /// The tick to wake up at, i.e. the first non-empty slot of level 0, or the next cascade
+    uint64_t GetNextWakeupTick() const;
+
+    void TimerThreadRoutine();
+
+private:
+    Clock::time_point startTime_;
+    mutable std::mutex mutex_ {};
+    std::condition_variable cv_ {};
+    uint64_t currentTick_ { 0 };
+    uint64_t wakeupTick_ { 0 }; // The tick that the timer thread is sleeping until
+    TimerId nextId_ { 1 };
+    std::array<std::array<Timer*, kNumSlots>, kNumLevels> slots_ {};
+    std::unordered_map<TimerId, Timer*> timers_ {};
+    bool isRunning_ { true };
+    std::thread thread_ {};
+};
+
+}
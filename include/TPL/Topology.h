@@ -0,0 +1,57 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace tpl {
+
+/// The location of a logical cpu, the ids are only meaningful for comparison
+struct CpuLocation {
+    int cpu { 0 };
+    int core { 0 }; // Unique in the machine, the hyper threads of a physical core have the same id
+    int cache { 0 }; // The cpus sharing the last level cache have the same id
+    int node { 0 }; // NUMA node
+};
+
+/// From near to far
+enum class CpuDistance {
+    kSameCore,
+    kSameCache,
+    kSameNode,
+    kRemote,
+};
+
+class CpuTopology {
+public:
+    /// The topology of the online cpus, which is read from /sys on Linux.
+    /// On the other platforms, or if /sys is unreadable or malformed, hardware_concurrency cpus are assumed, each cpu is a core, and they share one cache and one node
+    static const CpuTopology& Get();
+
+    const std::vector<CpuLocation>& GetCpus() const { return cpus_; }
+
+    /// Returns nullptr if cpu is not online
+    const CpuLocation* Find(int cpu) const;
+
+    /// The ids of the NUMA nodes, in ascending order
+    std::vector<int> GetNodes() const;
+
+    std::vector<int> GetCpusOfNode(int node) const;
+
+    /// The unknown cpus are assumed to be remote
+    CpuDistance GetDistance(int cpu1, int cpu2) const;
+
+private:
+    CpuTopology();
+
+private:
+    std::vector<CpuLocation> cpus_ {};
+};
+
+/// Pins the calling thread to the cpus, returns false if it fails or thread affinity is not supported on this platform
+bool PinCurrentThread(const std::vector<int>& cpus);
+
+}
@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// The tracer is compiled only if TPL_ENABLE_TRACING is defined (the TPL_ENABLE_TRACING cmake option),
+// otherwise nothing is recorded, and the dumped trace is empty
+
+namespace tpl {
+
+/// Starts recording the schedule, the start and the end of each task, and the dependency edges.
+/// Each thread records into its own ring buffer of capacityPerThread events, the oldest events are overwritten
+void StartTracing(size_t capacityPerThread = 1 << 16);
+
+void StopTracing();
+
+/// Drops the recorded events
+void ClearTrace();
+
+/// Writes the recorded events in the Chrome Trace Event format, which can be loaded by chrome://tracing or https://ui.perfetto.dev.
+/// The tasks are slices named by Task::SetName on the threads running them, the queueing and the dependencies are flow arrows.
+/// NOTE: Should be called once the traced tasks are done, the events being recorded concurrently may be partial
+void WriteChromeTrace(std::ostream& os);
+
+/// Returns false if the file can't be opened
+bool WriteChromeTrace(const std::string& path);
+
+namespace internal {
+
+#if defined(TPL_ENABLE_TRACING)
+    enum class TraceEventType : uint8_t {
+        kSchedule,
+        kBegin,
+        kEnd,
+        kDependency, // taskId depends on otherId
+    };
+
+    extern std::atomic_bool gIsTracing;
+
+    inline bool IsTracing() { return gIsTracing.load(std::memory_order_relaxed); }
+
+    uint64_t NewTraceId();
+
+    void RecordTraceEvent(TraceEventType type, uint64_t taskId, uint64_t otherId, const std::string* name);
+
+    inline void TraceSchedule(uint64_t taskId, const std::string& name)
+    {
+        if (IsTracing()) {
+            RecordTraceEvent(TraceEventType::kSchedule, taskId, 0, &name);
+        }
+    }
+
+    inline void TraceDependency(uint64_t parentId, uint64_t childId)
+    {
+        if (IsTracing()) {
+            RecordTraceEvent(TraceEventType::kDependency, childId, parentId, nullptr);
+        }
+    }
+
+    /// Records the begin and the end of running a task
+    class TaskTraceScope {
+    public:
+        TaskTraceScope(uint64_t taskId, const std::string& name)
+            : taskId_ { IsTracing() ? taskId : 0 }
+        {
+            if (taskId_ != 0) {
+                RecordTraceEvent(TraceEventType::kBegin, taskId_, 0, &name);
+            }
+        }
+
+        TaskTraceScope(const TaskTraceScope&) = delete;
+        TaskTraceScope& operator=(const TaskTraceScope&) = delete;
+
+        ~TaskTraceScope()
+        {
+            // Recorded even if the tracing is stopped in between, so the slice is closed
+            if (taskId_ != 0) {
+                RecordTraceEvent(TraceEventType::kEnd, taskId_, 0, nullptr);
+            }
+        }
+
+    private:
+        uint64_t taskId_;
+    };
+#endif
+
+}
+
+}
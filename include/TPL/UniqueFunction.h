@@ -0,0 +1,162 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace tpl {
+
+template <class Signature>
+class UniqueFunction;
+
+/// A move only std::function, small callables are stored inline.
+/// NOTE: The constructor from a callable is explicit, so that overloads taking std::function and UniqueFunction are not ambiguous
+template <class R, class... Args>
+class UniqueFunction<R(Args...)> {
+public:
+    // Large enough to hold a std::function, or a lambda that captures 4 pointers
+    static constexpr size_t kInlineSize = 4 * sizeof(void*);
+    static constexpr size_t kInlineAlignment = alignof(void*);
+
+    UniqueFunction() = default;
+
+    UniqueFunction(decltype(nullptr)) noexcept
+    {
+    }
+
+    template <class Functor, class = std::enable_if_t<!std::is_same_v<std::decay_t<Functor>, UniqueFunction>>>
+    explicit UniqueFunction(Functor&& functor)
+    {
+        using FunctorType = std::decay_t<Functor>;
+        static_assert(std::is_invocable_r_v<R, FunctorType&, Args...>);
+        if constexpr (IsStoredInline<FunctorType>()) {
+            new (storage_) FunctorType(std::forward<Functor>(functor));
+        } else {
+            *reinterpret_cast<FunctorType**>(storage_) = new FunctorType(std::forward<Functor>(functor));
+        }
+        ops_ = &kOps<FunctorType>;
+    }
+
+    UniqueFunction(const UniqueFunction&) = delete;
+
+    UniqueFunction(UniqueFunction&& other) noexcept
+    {
+        if (other.ops_ != nullptr) {
+            other.ops_->move(storage_, other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    ~UniqueFunction()
+    {
+        Reset();
+    }
+
+    UniqueFunction& operator=(const UniqueFunction&) = delete;
+
+    UniqueFunction& operator=(UniqueFunction&& other) noexcept
+    {
+        if (this != &other) {
+            Reset();
+            if (other.ops_ != nullptr) {
+                other.ops_->move(storage_, other.storage_);
+                ops_ = other.ops_;
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    UniqueFunction& operator=(decltype(nullptr)) noexcept
+    {
+        Reset();
+        return *this;
+    }
+
+    R operator()(Args... args)
+    {
+        assert(ops_ != nullptr);
+        return ops_->invoke(storage_, std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+    bool operator==(decltype(nullptr)) const noexcept { return ops_ == nullptr; }
+
+    bool operator!=(decltype(nullptr)) const noexcept { return ops_ != nullptr; }
+
+private:
+    struct Ops {
+        R (*invoke)(void* storage, Args&&... args);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* storage);
+    };
+
+    template <class FunctorType>
+    static constexpr bool IsStoredInline()
+    {
+        return sizeof(FunctorType) <= kInlineSize && alignof(FunctorType) <= kInlineAlignment && std::is_nothrow_move_constructible_v<FunctorType>;
+    }
+
+    template <class FunctorType>
+    static FunctorType* GetFunctor(void* storage)
+    {
+        if constexpr (IsStoredInline<FunctorType>()) {
+            return std::launder(reinterpret_cast<FunctorType*>(storage));
+        } else {
+            return *reinterpret_cast<FunctorType**>(storage);
+        }
+    }
+
+    template <class FunctorType>
+    static R Invoke(void* storage, Args&&... args)
+    {
+        return (*GetFunctor<FunctorType>(storage))(std::forward<Args>(args)...);
+    }
+
+    template <class FunctorType>
+    static void Move(void* dst, void* src)
+    {
+        if constexpr (IsStoredInline<FunctorType>()) {
+            auto* functor = GetFunctor<FunctorType>(src);
+            new (dst) FunctorType(std::move(*functor));
+            functor->~FunctorType();
+        } else {
+            *reinterpret_cast<FunctorType**>(dst) = GetFunctor<FunctorType>(src);
+        }
+    }
+
+    template <class FunctorType>
+    static void Destroy(void* storage)
+    {
+        if constexpr (IsStoredInline<FunctorType>()) {
+            GetFunctor<FunctorType>(storage)->~FunctorType();
+        } else {
+            delete GetFunctor<FunctorType>(storage);
+        }
+    }
+
+    template <class FunctorType>
+    static constexpr Ops kOps { &Invoke<FunctorType>, &Move<FunctorType>, &Destroy<FunctorType> };
+
+    void Reset()
+    {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    alignas(kInlineAlignment) unsigned char storage_[kInlineSize];
+    const Ops* ops_ { nullptr };
+};
+
+}
\ No newline at end of file
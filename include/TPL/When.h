@@ -0,0 +1,237 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/Task.h"
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tpl {
+
+namespace internal {
+
+    /// A listener of one of the input tasks, it dispatches to Owner::OnReady(future, index).
+    /// The listener holds a reference of the owner, which is released in Destroy.
+    template <class Owner>
+    struct IndexedListener final : FutureListener {
+        void Invoke(const FutureBase& future) final
+        {
+            owner->OnReady(future, index);
+        }
+
+        void Destroy() final
+        {
+            owner->Release();
+        }
+
+        Owner* owner { nullptr };
+        size_t index { 0 };
+    };
+
+    /// The shared state of WhenAll / WhenAny, the listeners of all the input tasks are allocated in one array.
+    template <class Derived, class T, class ResultType>
+    class WhenContext : public RefCounted {
+    public:
+        WhenContext(ITaskScheduler& scheduler, size_t count)
+            : result_ { MakeProxyTask<ResultType>(scheduler) }
+            , listeners_ { new IndexedListener<Derived>[count] }
+            , count_ { count }
+        {
+        }
+
+        /// Registers the listeners to the inputs, should be called after someone holds a reference of the context
+        void Connect(const std::vector<Task<T>>& tasks)
+        {
+            assert(tasks.size() == count_);
+            for (size_t i = 0; i < count_; ++i) {
+                auto& listener = listeners_[i];
+                listener.owner = static_cast<Derived*>(this);
+                listener.index = i;
+                // Released in IndexedListener::Destroy
+                this->AddRef();
+                tasks[i].GetFuture().AddListener(&listener);
+            }
+        }
+
+        const Task<ResultType>& GetResult() const { return result_; }
+
+    protected:
+        Future<ResultType>& GetResultFuture() { return const_cast<Future<ResultType>&>(result_.GetFuture()); }
+
+    protected:
+        Task<ResultType> result_;
+        std::unique_ptr<IndexedListener<Derived>[]> listeners_;
+        size_t count_;
+    };
+
+    template <class T>
+    using WhenAllResultType = std::conditional_t<std::is_same_v<void, T>, void, std::vector<T>>;
+
+    /// Holds no reference of the inputs, each listener puts the value of its input into its own slot of the preallocated values,
+    /// and the first failure completes the result at once, the remaining listeners just drop the reference of the context then.
+    template <class T>
+    class WhenAllContext final : public WhenContext<WhenAllContext<T>, T, WhenAllResultType<T>> {
+        using Base = WhenContext<WhenAllContext<T>, T, WhenAllResultType<T>>;
+
+    public:
+        WhenAllContext(ITaskScheduler& scheduler, const std::vector<Task<T>>& tasks)
+            : Base(scheduler, tasks.size())
+            , pendingCount_ { tasks.size() }
+        {
+            if constexpr (!std::is_same_v<void, T>) {
+                values_.resize(tasks.size());
+            }
+        }
+
+        void OnReady(const FutureBase& future, size_t index)
+        {
+            if (!future.HasValue()) {
+                if (!isDone_.exchange(true, std::memory_order_acq_rel)) {
+                    if (future.IsFaulted()) {
+                        this->GetResultFuture().SetException(future.GetException());
+                    } else {
+                        this->GetResultFuture().SetCanceled();
+                    }
+                }
+                return;
+            }
+            if (isDone_.load(std::memory_order_relaxed)) {
+                // Failed already, the value is not needed
+                return;
+            }
+            if constexpr (!std::is_same_v<void, T>) {
+                auto& input = const_cast<Future<T>&>(static_cast<const Future<T>&>(future));
+                if constexpr (std::is_copy_constructible_v<T>) {
+                    values_[index].emplace(input.GetValue());
+                } else {
+                    values_[index].emplace(input.TakeValue());
+                }
+            }
+            // The slots are published to the last one by pendingCount_
+            if (pendingCount_.fetch_sub(1, std::memory_order_acq_rel) != 1 || isDone_.exchange(true, std::memory_order_acq_rel)) {
+                return;
+            }
+            if constexpr (std::is_same_v<void, T>) {
+                this->GetResultFuture().SetValue();
+            } else {
+                std::vector<T> values;
+                values.reserve(values_.size());
+                for (auto& value : values_) {
+                    values.push_back(std::move(*value));
+                }
+                values_.clear();
+                this->GetResultFuture().SetValue(std::move(values));
+            }
+        }
+
+    private:
+        struct Empty {
+        };
+
+        std::atomic<size_t> pendingCount_;
+        std::atomic_bool isDone_ { false };
+        std::conditional_t<std::is_same_v<void, T>, Empty, std::vector<std::optional<T>>> values_ {};
+    };
+
+    template <class T>
+    using WhenAnyResultType = std::conditional_t<std::is_same_v<void, T>, size_t, std::pair<size_t, T>>;
+
+    /// Holds no reference of the inputs, so the tasks that lose the race are not kept alive by WhenAny,
+    /// their listeners just drop the reference of the context once they are invoked or destroyed.
+    template <class T>
+    class WhenAnyContext final : public WhenContext<WhenAnyContext<T>, T, WhenAnyResultType<T>> {
+        using Base = WhenContext<WhenAnyContext<T>, T, WhenAnyResultType<T>>;
+
+    public:
+        WhenAnyContext(ITaskScheduler& scheduler, const std::vector<Task<T>>& tasks)
+            : Base(scheduler, tasks.size())
+            , remainingCount_ { tasks.size() }
+        {
+        }
+
+        void OnReady(const FutureBase& future, size_t index)
+        {
+            if (!future.HasValue()) {
+                // Fails only if all the inputs fail, as the last one
+                if (remainingCount_.fetch_sub(1, std::memory_order_acq_rel) == 1 && !isDone_.exchange(true, std::memory_order_acq_rel)) {
+                    if (future.IsFaulted()) {
+                        this->GetResultFuture().SetException(future.GetException());
+                    } else {
+                        this->GetResultFuture().SetCanceled();
+                    }
+                }
+                return;
+            }
+            if (isDone_.exchange(true, std::memory_order_acq_rel)) {
+                return;
+            }
+            if constexpr (std::is_same_v<void, T>) {
+                this->GetResultFuture().SetValue(index);
+            } else {
+                this->GetResultFuture().SetValue(std::make_pair(index, static_cast<const Future<T>&>(future).GetValue()));
+            }
+        }
+
+    private:
+        std::atomic<size_t> remainingCount_;
+        std::atomic_bool isDone_ { false };
+    };
+
+    template <class T>
+    inline ITaskScheduler& ResolveWhenScheduler(const std::vector<Task<T>>& tasks, ITaskScheduler* scheduler)
+    {
+        if (scheduler == nullptr) {
+            scheduler = tasks.empty() ? gDefaultTaskScheduler : tasks.front().GetScheduler();
+            assert(scheduler != nullptr); // "Did you forget to specify a scheduler?"
+        }
+        return *scheduler;
+    }
+
+}
+
+/// Creates a proxy task which is ready once all the tasks are ready, the values are in the order of tasks.
+/// If any of the tasks is canceled or faulted, the proxy task is completed as the first of them to fail, without waiting for the others.
+/// The values are copied into the result, a move-only value is moved out of its task, which should have no other consumer.
+/// Returns a Task<std::vector<T>>, or a Task<void> if T is void.
+/// If scheduler == nullptr, the scheduler of the first task will be used
+template <class T>
+inline auto WhenAll(const std::vector<Task<T>>& tasks, ITaskScheduler* scheduler = nullptr)
+{
+    auto& sched = internal::ResolveWhenScheduler(tasks, scheduler);
+    RefCntAutoPtr<internal::WhenAllContext<T>> context(new internal::WhenAllContext<T>(sched, tasks));
+    auto result = context->GetResult();
+    if (tasks.empty()) {
+        if constexpr (std::is_same_v<void, T>) {
+            const_cast<Future<void>&>(result.GetFuture()).SetValue();
+        } else {
+            const_cast<Future<std::vector<T>>&>(result.GetFuture()).SetValue(std::vector<T> {});
+        }
+        return result;
+    }
+    context->Connect(tasks);
+    return result;
+}
+
+/// Creates a proxy task which is ready once any of the tasks is ready with a value.
+/// If all the tasks are canceled or faulted, the proxy task is completed as the last of them.
+/// Returns a Task<std::pair<size_t, T>> of the index and the value of the first finished task, or a Task<size_t> of the index if T is void.
+/// If scheduler == nullptr, the scheduler of the first task will be used
+/// NOTE: tasks should not be empty
+template <class T>
+inline auto WhenAny(const std::vector<Task<T>>& tasks, ITaskScheduler* scheduler = nullptr)
+{
+    assert(!tasks.empty());
+    auto& sched = internal::ResolveWhenScheduler(tasks, scheduler);
+    RefCntAutoPtr<internal::WhenAnyContext<T>> context(new internal::WhenAnyContext<T>(sched, tasks));
+    auto result = context->GetResult();
+    context->Connect(tasks);
+    return result;
+}
+
+}
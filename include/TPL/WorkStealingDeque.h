@@ -0,0 +1,147 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/Platform.h"
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace tpl {
+
+/// A Chase-Lev work stealing deque.
+/// The owner thread pushes and pops at the bottom, any other thread may steal from the top.
+/// NOTE: The element type should be trivially copyable (usually a pointer), since it will be read and write concurrently.
+template <class T>
+class WorkStealingDeque {
+    static_assert(std::is_trivially_copyable_v<T>, "The element of WorkStealingDeque should be trivially copyable");
+
+public:
+    explicit WorkStealingDeque(int64_t capacity = 256)
+    {
+        assert(capacity > 0 && (capacity & (capacity - 1)) == 0); // capacity should be power of 2
+        auto* array = new Array(capacity);
+        arrays_.emplace_back(array);
+        array_.store(array, std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque(WorkStealingDeque&&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(WorkStealingDeque&&) = delete;
+
+    ~WorkStealingDeque() = default;
+
+    /// Can only be called by the owner thread
+    void Push(T item)
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Array* array = array_.load(std::memory_order_relaxed);
+        if (b - t > array->capacity - 1) {
+            array = Grow(array, b, t);
+        }
+        array->Put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /// Can only be called by the owner thread
+    bool Pop(T& item)
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array* array = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) {
+            // Empty
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = array->Get(b);
+        if (t == b) {
+            // The last element, race with the thieves
+            bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    /// Can be called by any thread, a false return value means the deque is empty or the race is lost
+    bool Steal(T& item)
+    {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        Array* array = array_.load(std::memory_order_acquire);
+        T stolen = array->Get(t);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return false;
+        }
+        item = stolen;
+        return true;
+    }
+
+    bool Empty() const
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+    size_t Size() const
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        return b > t ? static_cast<size_t>(b - t) : 0;
+    }
+
+private:
+    struct Array {
+        explicit Array(int64_t cap)
+            : capacity { cap }
+            , mask { cap - 1 }
+            , buffer { new std::atomic<T>[cap] }
+        {
+        }
+
+        T Get(int64_t i) const { return buffer[i & mask].load(std::memory_order_relaxed); }
+
+        void Put(int64_t i, T item) { buffer[i & mask].store(item, std::memory_order_relaxed); }
+
+        int64_t capacity;
+        int64_t mask;
+        std::unique_ptr<std::atomic<T>[]> buffer;
+    };
+
+    Array* Grow(Array* array, int64_t b, int64_t t)
+    {
+        auto* newArray = new Array(array->capacity * 2);
+        for (int64_t i = t; i < b; ++i) {
+            newArray->Put(i, array->Get(i));
+        }
+        // The old array may still be read by the thieves, so we keep it until the deque is destroyed
+        arrays_.emplace_back(newArray);
+        array_.store(newArray, std::memory_order_release);
+        return newArray;
+    }
+
+private:
+    // The top is written by the thieves, and the bottom by the owner
+    alignas(internal::kCacheLineSize) std::atomic<int64_t> top_ { 0 };
+    alignas(internal::kCacheLineSize) std::atomic<int64_t> bottom_ { 0 };
+    std::atomic<Array*> array_ { nullptr };
+    std::vector<std::unique_ptr<Array>> arrays_ {};
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,388 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "TPL/Scheduler.h"
+#include "TPL/Topology.h"
+#include "TPL/WorkStealingDeque.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+
+namespace tpl {
+
+/// A scheduler that each worker owns a Chase-Lev deque.
+/// Tasks scheduled in the worker threads are pushed to the worker's local deque,
+/// tasks scheduled from other threads are pushed to a shared injection queue.
+/// Idle workers steal tasks from random victims.
+/// If the workers are pinned, the victims are tried from near to far: the same core, the same last level cache, the same NUMA node, then the others.
+class WorkStealingTaskScheduler final : public ITaskScheduler {
+public:
+    struct Options {
+        size_t numThreads { std::max(1u, std::thread::hardware_concurrency()) };
+        /// Worker i is pinned to cpus[i % cpus.size()], the workers are not pinned if it's empty
+        std::vector<int> cpus {};
+    };
+
+    WorkStealingTaskScheduler()
+        : WorkStealingTaskScheduler(std::max(1u, std::thread::hardware_concurrency()))
+    {
+    }
+
+    explicit WorkStealingTaskScheduler(size_t numThreads)
+        : WorkStealingTaskScheduler(MakeOptions(numThreads))
+    {
+    }
+
+    explicit WorkStealingTaskScheduler(const Options& options)
+    {
+        const size_t numThreads = options.numThreads;
+        assert(numThreads > 0); // Ensure the thread number > 0
+        workers_.resize(numThreads);
+        for (size_t i = 0; i < numThreads; ++i) {
+            workers_[i] = std::make_unique<Worker>();
+            workers_[i]->owner = this;
+            workers_[i]->index = i;
+            workers_[i]->randomState = static_cast<uint32_t>(i * 2654435761u + 1u);
+            if (!options.cpus.empty()) {
+                workers_[i]->cpu = options.cpus[i % options.cpus.size()];
+            }
+        }
+        BuildVictimGroups();
+
+        isRunning_ = true;
+        for (auto& worker : workers_) {
+            worker->thread = std::thread([this, w = worker.get()]() {
+                WorkerThreadRoutine(w);
+            });
+        }
+    }
+
+    WorkStealingTaskScheduler(WorkStealingTaskScheduler&&) = delete;
+    WorkStealingTaskScheduler(const WorkStealingTaskScheduler&) = delete;
+    WorkStealingTaskScheduler& operator=(WorkStealingTaskScheduler&&) = delete;
+    WorkStealingTaskScheduler& operator=(const WorkStealingTaskScheduler&) = delete;
+
+    ~WorkStealingTaskScheduler() final
+    {
+        {
+            std::unique_lock<std::mutex> lck(sleepMutex_);
+            isRunning_ = false;
+        }
+        sleepCv_.notify_all();
+        for (auto& worker : workers_) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+        // The workers drain all the queues before exit, but let's be defensive
+        for (auto* job : injectionQueue_) {
+            delete job;
+        }
+        for (auto& worker : workers_) {
+            Job* job { nullptr };
+            while (worker->deque.Pop(job)) {
+                delete job;
+            }
+        }
+    }
+
+    // The priority is ignored, the tasks are executed in the order they are found
+    using ITaskScheduler::Schedule;
+    using ITaskScheduler::ScheduleBatch;
+
+    void Schedule(const std::function<void()>& functor) final
+    {
+        Push(new Job { UniqueFunction<void()>(functor) });
+    }
+
+    void Schedule(UniqueFunction<void()>&& functor) final
+    {
+        Push(new Job { std::move(functor) });
+    }
+
+    void ScheduleBatch(UniqueFunction<void()>* functors, size_t count) final
+    {
+        if (count == 0) {
+            return;
+        }
+        Worker* current = tCurrentWorker_;
+        if (current != nullptr && current->owner == this) {
+            for (size_t i = 0; i < count; ++i) {
+                current->deque.Push(new Job { std::move(functors[i]) });
+            }
+        } else {
+            std::unique_lock<std::mutex> lck(injectionMutex_);
+            for (size_t i = 0; i < count; ++i) {
+                injectionQueue_.push_back(new Job { std::move(functors[i]) });
+            }
+            injectionCount_.fetch_add(count, std::memory_order_relaxed);
+        }
+        Wake(count);
+    }
+
+    /// Only the workers of this scheduler can take a job, from the bottom of its own deque, which is likely a child of the waiting task
+    bool TryRunOne() final
+    {
+        Worker* current = tCurrentWorker_;
+        if (current == nullptr || current->owner != this) {
+            return false;
+        }
+        Job* job { nullptr };
+        if (!current->deque.Pop(job)) {
+            return false;
+        }
+        if (job->depth <= internal::tTaskDepth) {
+            // Pushed by a task under the waiting one
+            current->deque.Push(job);
+            return false;
+        }
+        RunJob(current, job);
+        return true;
+    }
+
+    /// NOTE: Should be set before any task is created with this scheduler
+    void SetTaskAllocator(ITaskAllocator* allocator) { taskAllocator_ = allocator; }
+
+    ITaskAllocator* GetTaskAllocator() const final { return taskAllocator_; }
+
+    size_t GetConcurrency() const final { return workers_.size(); }
+
+    /// The queue depth is always reported, the worker stats only if TPL_ENABLE_STATS is defined
+    SchedulerStats GetStats() const final
+    {
+        SchedulerStats stats;
+        stats.queueDepth = injectionCount_.load(std::memory_order_relaxed);
+        for (auto& worker : workers_) {
+            stats.queueDepth += worker->deque.Size();
+        }
+#if defined(TPL_ENABLE_STATS)
+        stats.isEnabled = true;
+        for (auto& worker : workers_) {
+            stats.workers.push_back(worker->counters.Snapshot());
+            stats.total.Merge(stats.workers.back());
+        }
+#endif
+        return stats;
+    }
+
+    /// Creates one scheduler per NUMA node, the workers of which are pinned to the cpus of the node one by one.
+    /// The schedulers are in the order of CpuTopology::GetNodes
+    static std::vector<std::unique_ptr<WorkStealingTaskScheduler>> CreatePerNode()
+    {
+        auto& topology = CpuTopology::Get();
+        std::vector<std::unique_ptr<WorkStealingTaskScheduler>> schedulers;
+        for (int node : topology.GetNodes()) {
+            Options options;
+            options.cpus = topology.GetCpusOfNode(node);
+            options.numThreads = options.cpus.size();
+            schedulers.push_back(std::make_unique<WorkStealingTaskScheduler>(options));
+        }
+        return schedulers;
+    }
+
+private:
+    struct Job {
+        UniqueFunction<void()> functor;
+        uint32_t depth { internal::tTaskDepth + 1 };
+#if defined(TPL_ENABLE_STATS)
+        internal::EnqueueStamp stamp {};
+#endif
+    };
+
+    struct alignas(internal::kCacheLineSize) Worker {
+        WorkStealingDeque<Job*> deque {};
+        std::thread thread {};
+        WorkStealingTaskScheduler* owner { nullptr };
+        size_t index { 0 };
+        uint32_t randomState { 1 };
+        int cpu { -1 };
+        internal::WorkerCounters counters {};
+        /// The other workers grouped by the distance, from near to far, the empty groups are dropped
+        std::vector<std::vector<Worker*>> victimGroups {};
+    };
+
+    static Options MakeOptions(size_t numThreads)
+    {
+        Options options;
+        options.numThreads = numThreads;
+        return options;
+    }
+
+    void BuildVictimGroups()
+    {
+        auto& topology = CpuTopology::Get();
+        for (auto& thief : workers_) {
+            std::vector<std::vector<Worker*>> groups(static_cast<size_t>(CpuDistance::kRemote) + 1);
+            for (auto& victim : workers_) {
+                if (victim == thief) {
+                    continue;
+                }
+                // The workers not pinned are in one group
+                auto distance = thief->cpu < 0 || victim->cpu < 0 ? CpuDistance::kRemote : topology.GetDistance(thief->cpu, victim->cpu);
+                groups[static_cast<size_t>(distance)].push_back(victim.get());
+            }
+            for (auto& group : groups) {
+                if (!group.empty()) {
+                    thief->victimGroups.push_back(std::move(group));
+                }
+            }
+        }
+    }
+
+    void Push(Job* job)
+    {
+        Worker* current = tCurrentWorker_;
+        if (current != nullptr && current->owner == this) {
+            current->deque.Push(job);
+        } else {
+            std::unique_lock<std::mutex> lck(injectionMutex_);
+            injectionQueue_.push_back(job);
+            injectionCount_.fetch_add(1, std::memory_order_relaxed);
+        }
+        Wake(1);
+    }
+
+    /// Wakes up at most count sleeping workers
+    void Wake(size_t count)
+    {
+        // Pairs with the sleeperCount_ increment in WorkerThreadRoutine, either the worker sees the new job,
+        // or we see the sleeper
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        size_t sleeperCount = sleeperCount_.load(std::memory_order_relaxed);
+        if (sleeperCount > 0) {
+            {
+                std::unique_lock<std::mutex> lck(sleepMutex_);
+            }
+            if (count >= sleeperCount) {
+                sleepCv_.notify_all();
+            } else {
+                for (size_t i = 0; i < count; ++i) {
+                    sleepCv_.notify_one();
+                }
+            }
+        }
+    }
+
+    Job* PopInjection()
+    {
+        if (injectionCount_.load(std::memory_order_relaxed) == 0) {
+            return nullptr;
+        }
+        std::unique_lock<std::mutex> lck(injectionMutex_);
+        if (injectionQueue_.empty()) {
+            return nullptr;
+        }
+        Job* job = injectionQueue_.front();
+        injectionQueue_.pop_front();
+        injectionCount_.fetch_sub(1, std::memory_order_relaxed);
+        return job;
+    }
+
+    Job* Steal(Worker* thief)
+    {
+        if (thief->victimGroups.empty()) {
+            return nullptr;
+        }
+        // xorshift32
+        uint32_t x = thief->randomState;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        thief->randomState = x;
+
+        // Random victims in a group, so the thieves don't contend on the same one
+        for (auto& group : thief->victimGroups) {
+            const size_t groupSize = group.size();
+            size_t start = x % groupSize;
+            for (size_t i = 0; i < groupSize; ++i) {
+                Job* job { nullptr };
+                if (group[(start + i) % groupSize]->deque.Steal(job)) {
+                    thief->counters.RecordStolen();
+                    return job;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    Job* FindJob(Worker* worker)
+    {
+        Job* job { nullptr };
+        if (worker->deque.Pop(job)) {
+            return job;
+        }
+        if ((job = PopInjection()) != nullptr) {
+            return job;
+        }
+        return Steal(worker);
+    }
+
+    void WorkerThreadRoutine(Worker* worker)
+    {
+        if (worker->cpu >= 0) {
+            PinCurrentThread({ worker->cpu });
+        }
+        TaskSchedulerScope scope(this);
+        tCurrentWorker_ = worker;
+        while (true) {
+            Job* job = FindJob(worker);
+            if (job == nullptr) {
+                auto idleStart = internal::StatsNow();
+                std::unique_lock<std::mutex> lck(sleepMutex_);
+                sleeperCount_.fetch_add(1, std::memory_order_seq_cst);
+                job = FindJob(worker);
+                if (job == nullptr) {
+                    if (!isRunning_) {
+                        sleeperCount_.fetch_sub(1, std::memory_order_relaxed);
+                        break;
+                    }
+                    sleepCv_.wait(lck);
+                }
+                sleeperCount_.fetch_sub(1, std::memory_order_relaxed);
+                worker->counters.RecordIdle(idleStart);
+                if (job == nullptr) {
+                    continue;
+                }
+            }
+            RunJob(worker, job);
+        }
+        tCurrentWorker_ = nullptr;
+    }
+
+    void RunJob(Worker* worker, Job* job)
+    {
+        std::unique_ptr<Job> holder { job };
+        assert(holder->functor != nullptr);
+#if defined(TPL_ENABLE_STATS)
+        worker->counters.RecordQueueWait(holder->stamp);
+#endif
+        auto runStart = internal::StatsNow();
+        internal::TaskDepthScope depth(holder->depth);
+        holder->functor();
+        worker->counters.RecordRun(runStart);
+    }
+
+private:
+    std::vector<std::unique_ptr<Worker>> workers_ {};
+
+    bool isRunning_ { false };
+
+    ITaskAllocator* taskAllocator_ { nullptr };
+
+    // The shared injection queue for the tasks scheduled from outside, the count is polled by the idle workers
+    alignas(internal::kCacheLineSize) std::deque<Job*> injectionQueue_ {};
+    std::atomic<size_t> injectionCount_ { 0 };
+    std::mutex injectionMutex_ {};
+
+    // The count is read by every Schedule call
+    alignas(internal::kCacheLineSize) std::atomic<size_t> sleeperCount_ { 0 };
+    std::mutex sleepMutex_ {};
+    std::condition_variable sleepCv_ {};
+
+    static thread_local Worker* tCurrentWorker_;
+};
+
+}
\ No newline at end of file
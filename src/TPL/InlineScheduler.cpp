@@ -0,0 +1,11 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TPL/InlineScheduler.h"
+
+namespace tpl {
+
+thread_local InlineTaskScheduler::ThreadState InlineTaskScheduler::tState_ {};
+
+}
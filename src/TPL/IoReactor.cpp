@@ -0,0 +1,433 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TPL/IoReactor.h"
+
+#if defined(TPL_HAS_IO_REACTOR)
+
+#include "TPL/Algorithm.h"
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace tpl {
+
+namespace {
+
+    std::exception_ptr MakeSystemError(int error, const char* what)
+    {
+        return std::make_exception_ptr(std::system_error(error, std::generic_category(), what));
+    }
+
+    bool WouldBlock(int error)
+    {
+        return error == EAGAIN || error == EWOULDBLOCK;
+    }
+
+    /// The result of a syscall, either a value or an errno
+    template <class T>
+    class IoOperationBase : public internal::IoOperation {
+    public:
+        IoOperationBase(ITaskScheduler& scheduler, const char* what)
+            : task_ { internal::MakeProxyTask<T>(scheduler) }
+            , what_ { what }
+        {
+        }
+
+        const Task<T>& GetTask() const { return task_; }
+
+        void Complete() final
+        {
+            auto& future = const_cast<Future<T>&>(task_.GetFuture());
+            if (error_ != 0) {
+                future.SetException(MakeSystemError(error_, what_));
+            } else if constexpr (std::is_same_v<void, T>) {
+                future.SetValue();
+            } else {
+                future.SetValue(std::move(value_));
+            }
+        }
+
+        void Cancel() final
+        {
+            const_cast<Future<T>&>(task_.GetFuture()).SetCanceled();
+        }
+
+        void SetError(int error) final { error_ = error; }
+
+    protected:
+        /// Returns false if the syscall would block, otherwise records errno as the failure
+        bool Fail()
+        {
+            if (WouldBlock(errno)) {
+                return false;
+            }
+            error_ = errno == 0 ? EIO : errno;
+            return true;
+        }
+
+    protected:
+        Task<T> task_;
+        const char* what_;
+        int error_ { 0 };
+        std::conditional_t<std::is_same_v<void, T>, bool, T> value_ {};
+    };
+
+    class ReadOperation final : public IoOperationBase<size_t> {
+    public:
+        ReadOperation(ITaskScheduler& scheduler, int fd, void* buffer, size_t size)
+            : IoOperationBase(scheduler, "read")
+            , fd_ { fd }
+            , buffer_ { buffer }
+            , size_ { size }
+        {
+        }
+
+        bool Perform() final
+        {
+            ssize_t n;
+            do {
+                n = ::read(fd_, buffer_, size_);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                return Fail();
+            }
+            value_ = static_cast<size_t>(n);
+            return true;
+        }
+
+    private:
+        int fd_;
+        void* buffer_;
+        size_t size_;
+    };
+
+    class ReadBufferOperation final : public IoOperationBase<std::vector<char>> {
+    public:
+        ReadBufferOperation(ITaskScheduler& scheduler, int fd, size_t maxSize)
+            : IoOperationBase(scheduler, "read")
+            , fd_ { fd }
+        {
+            value_.resize(maxSize);
+        }
+
+        bool Perform() final
+        {
+            ssize_t n;
+            do {
+                n = ::read(fd_, value_.data(), value_.size());
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                return Fail();
+            }
+            value_.resize(static_cast<size_t>(n));
+            return true;
+        }
+
+    private:
+        int fd_;
+    };
+
+    class WriteOperation final : public IoOperationBase<size_t> {
+    public:
+        WriteOperation(ITaskScheduler& scheduler, int fd, const void* buffer, size_t size)
+            : IoOperationBase(scheduler, "write")
+            , fd_ { fd }
+            , buffer_ { static_cast<const char*>(buffer) }
+            , size_ { size }
+        {
+        }
+
+        /// Keeps the progress of the partial writes, the task is ready once all the bytes are written
+        bool Perform() final
+        {
+            while (value_ < size_) {
+                ssize_t n = ::write(fd_, buffer_ + value_, size_ - value_);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return Fail();
+                }
+                value_ += static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+    private:
+        int fd_;
+        const char* buffer_;
+        size_t size_;
+    };
+
+    class AcceptOperation final : public IoOperationBase<int> {
+    public:
+        AcceptOperation(ITaskScheduler& scheduler, int fd)
+            : IoOperationBase(scheduler, "accept")
+            , fd_ { fd }
+        {
+        }
+
+        bool Perform() final
+        {
+            int n;
+            do {
+                n = ::accept4(fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                return Fail();
+            }
+            value_ = n;
+            return true;
+        }
+
+    private:
+        int fd_;
+    };
+
+    /// Owns the timerfd, which is closed once the operation is destroyed, i.e. after it is unregistered
+    class TimerOperation final : public IoOperationBase<void> {
+    public:
+        TimerOperation(ITaskScheduler& scheduler, int fd)
+            : IoOperationBase(scheduler, "timerfd")
+            , fd_ { fd }
+        {
+        }
+
+        ~TimerOperation() final { ::close(fd_); }
+
+        bool Perform() final
+        {
+            uint64_t expirations;
+            if (::read(fd_, &expirations, sizeof(expirations)) < 0) {
+                return Fail();
+            }
+            return true;
+        }
+
+    private:
+        int fd_;
+    };
+
+}
+
+IoReactor::IoReactor(ITaskScheduler* scheduler)
+    : scheduler_ { scheduler }
+{
+    epollFd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0) {
+        throw std::system_error(errno, std::generic_category(), "epoll_create1");
+    }
+    wakeupFd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeupFd_ < 0) {
+        int error = errno;
+        ::close(epollFd_);
+        throw std::system_error(error, std::generic_category(), "eventfd");
+    }
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.fd = wakeupFd_;
+    if (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeupFd_, &event) < 0) {
+        // The reactor thread would never see the wakeup of the destructor
+        int error = errno;
+        ::close(wakeupFd_);
+        ::close(epollFd_);
+        throw std::system_error(error, std::generic_category(), "epoll_ctl");
+    }
+    thread_ = std::thread(&IoReactor::ReactorThreadRoutine, this);
+}
+
+IoReactor::~IoReactor()
+{
+    {
+        std::unique_lock<std::mutex> lck(mutex_);
+        isRunning_ = false;
+    }
+    uint64_t one = 1;
+    [[maybe_unused]] auto n = ::write(wakeupFd_, &one, sizeof(one));
+    thread_.join();
+
+    std::vector<std::unique_ptr<internal::IoOperation>> canceled;
+    for (auto& [fd, state] : fds_) {
+        for (auto* queue : { &state.readers, &state.writers }) {
+            for (auto& operation : *queue) {
+                canceled.push_back(std::move(operation));
+            }
+        }
+        if (state.isRegistered) {
+            ::epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+        }
+    }
+    fds_.clear();
+    for (auto& operation : canceled) {
+        operation->Cancel();
+    }
+    ::close(wakeupFd_);
+    ::close(epollFd_);
+}
+
+Task<size_t> IoReactor::Read(int fd, void* buffer, size_t size)
+{
+    auto operation = std::make_unique<ReadOperation>(GetScheduler(), fd, buffer, size);
+    auto task = operation->GetTask();
+    Submit(fd, false, std::move(operation));
+    return task;
+}
+
+Task<std::vector<char>> IoReactor::Read(int fd, size_t maxSize)
+{
+    auto operation = std::make_unique<ReadBufferOperation>(GetScheduler(), fd, maxSize);
+    auto task = operation->GetTask();
+    Submit(fd, false, std::move(operation));
+    return task;
+}
+
+Task<size_t> IoReactor::Write(int fd, const void* buffer, size_t size)
+{
+    auto operation = std::make_unique<WriteOperation>(GetScheduler(), fd, buffer, size);
+    auto task = operation->GetTask();
+    Submit(fd, true, std::move(operation));
+    return task;
+}
+
+Task<int> IoReactor::Accept(int fd)
+{
+    auto operation = std::make_unique<AcceptOperation>(GetScheduler(), fd);
+    auto task = operation->GetTask();
+    Submit(fd, false, std::move(operation));
+    return task;
+}
+
+Task<void> IoReactor::Sleep(std::chrono::nanoseconds duration)
+{
+    auto& scheduler = GetScheduler();
+    int fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        auto task = internal::MakeProxyTask<void>(scheduler);
+        const_cast<Future<void>&>(task.GetFuture()).SetException(MakeSystemError(errno, "timerfd_create"));
+        return task;
+    }
+    auto operation = std::make_unique<TimerOperation>(scheduler, fd);
+    auto task = operation->GetTask();
+    // A zero it_value disarms the timer, so the shortest duration is 1ns
+    auto count = std::max<std::chrono::nanoseconds::rep>(duration.count(), 1);
+    itimerspec spec {};
+    spec.it_value.tv_sec = static_cast<time_t>(count / 1000000000);
+    spec.it_value.tv_nsec = static_cast<long>(count % 1000000000);
+    ::timerfd_settime(fd, 0, &spec, nullptr);
+    Submit(fd, false, std::move(operation));
+    return task;
+}
+
+void IoReactor::Submit(int fd, bool isWrite, std::unique_ptr<internal::IoOperation> operation)
+{
+    std::vector<std::unique_ptr<internal::IoOperation>> completed;
+    {
+        std::unique_lock<std::mutex> lck(mutex_);
+        auto& state = fds_[fd];
+        auto& queue = isWrite ? state.writers : state.readers;
+        // Tries immediately unless the earlier operations are still waiting, to keep the order
+        if (queue.empty() && operation->Perform()) {
+            completed.push_back(std::move(operation));
+            if (state.readers.empty() && state.writers.empty() && !state.isRegistered) {
+                fds_.erase(fd);
+            }
+        } else {
+            queue.push_back(std::move(operation));
+            UpdateRegistration(fd, state, completed);
+        }
+    }
+    for (auto& op : completed) {
+        op->Complete();
+    }
+}
+
+void IoReactor::PerformQueued(std::deque<std::unique_ptr<internal::IoOperation>>& queue, std::vector<std::unique_ptr<internal::IoOperation>>& completed)
+{
+    while (!queue.empty() && queue.front()->Perform()) {
+        completed.push_back(std::move(queue.front()));
+        queue.pop_front();
+    }
+}
+
+void IoReactor::UpdateRegistration(int fd, FdState& state, std::vector<std::unique_ptr<internal::IoOperation>>& completed)
+{
+    uint32_t events = (state.readers.empty() ? 0 : EPOLLIN) | (state.writers.empty() ? 0 : EPOLLOUT);
+    if (events != 0) {
+        epoll_event event {};
+        event.events = events | EPOLLONESHOT;
+        event.data.fd = fd;
+        if (::epoll_ctl(epollFd_, state.isRegistered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) == 0) {
+            state.isRegistered = true;
+            return;
+        }
+        // e.g. a regular file, which can't be polled
+        int error = errno;
+        for (auto* queue : { &state.readers, &state.writers }) {
+            for (auto& operation : *queue) {
+                operation->SetError(error);
+                completed.push_back(std::move(operation));
+            }
+        }
+    }
+    if (state.isRegistered) {
+        ::epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    fds_.erase(fd);
+}
+
+void IoReactor::ReactorThreadRoutine()
+{
+    constexpr int kMaxEvents = 64;
+    epoll_event events[kMaxEvents];
+    std::vector<std::unique_ptr<internal::IoOperation>> completed;
+    while (true) {
+        int count = ::epoll_wait(epollFd_, events, kMaxEvents, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        {
+            std::unique_lock<std::mutex> lck(mutex_);
+            if (!isRunning_) {
+                break;
+            }
+            for (int i = 0; i < count; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == wakeupFd_) {
+                    continue;
+                }
+                auto it = fds_.find(fd);
+                if (it == fds_.end()) {
+                    continue;
+                }
+                auto& state = it->second;
+                // The error / hang up is reported by the syscalls themselves
+                PerformQueued(state.readers, completed);
+                PerformQueued(state.writers, completed);
+                UpdateRegistration(fd, state, completed);
+            }
+        }
+        for (auto& operation : completed) {
+            operation->Complete();
+        }
+        completed.clear();
+    }
+}
+
+ITaskScheduler& IoReactor::GetScheduler() const
+{
+    return internal::ResolveScheduler(scheduler_);
+}
+
+}
+
+#endif
@@ -8,4 +8,12 @@ namespace tpl {
 
 ITaskScheduler* gDefaultTaskScheduler { nullptr };
 
+thread_local ITaskScheduler* tCurrentTaskScheduler { nullptr };
+
+namespace internal {
+    thread_local uint32_t tTaskDepth { 0 };
+    thread_local uint32_t tHelpingWaitDepth { 0 };
+    thread_local bool tIsHelpingWait { false };
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,71 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TPL/Stats.h"
+#include <map>
+#include <mutex>
+
+namespace tpl {
+
+#if defined(TPL_ENABLE_STATS)
+namespace {
+
+    std::atomic_bool gIsTaskNameStatsEnabled { false };
+    std::mutex gTaskNameStatsMutex {};
+    std::map<std::string, LatencyHistogram> gTaskNameStats {};
+
+}
+
+namespace internal {
+
+    bool IsTaskNameStatsEnabled()
+    {
+        return gIsTaskNameStatsEnabled.load(std::memory_order_relaxed);
+    }
+
+    void RecordTaskRun(const std::string& name, uint64_t nanoseconds)
+    {
+        std::unique_lock<std::mutex> lck(gTaskNameStatsMutex);
+        gTaskNameStats[name].Record(nanoseconds);
+    }
+
+}
+
+void EnableTaskNameStats(bool enable)
+{
+    gIsTaskNameStatsEnabled.store(enable, std::memory_order_relaxed);
+}
+
+std::vector<TaskNameStats> GetTaskNameStats()
+{
+    std::vector<TaskNameStats> result;
+    std::unique_lock<std::mutex> lck(gTaskNameStatsMutex);
+    result.reserve(gTaskNameStats.size());
+    for (auto& [name, run] : gTaskNameStats) {
+        result.push_back(TaskNameStats { name, run });
+    }
+    return result;
+}
+
+void ResetTaskNameStats()
+{
+    std::unique_lock<std::mutex> lck(gTaskNameStatsMutex);
+    gTaskNameStats.clear();
+}
+#else
+void EnableTaskNameStats(bool)
+{
+}
+
+std::vector<TaskNameStats> GetTaskNameStats()
+{
+    return {};
+}
+
+void ResetTaskNameStats()
+{
+}
+#endif
+
+}
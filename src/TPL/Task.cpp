@@ -0,0 +1,13 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TPL/Task.h"
+
+namespace tpl {
+
+namespace internal {
+    thread_local int tInlineContinuationDepth { 0 };
+}
+
+}
\ No newline at end of file
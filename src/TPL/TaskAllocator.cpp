@@ -0,0 +1,182 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TPL/TaskAllocator.h"
+#include <new>
+
+namespace tpl {
+
+namespace {
+
+    constexpr size_t kHeaderSize = 16;
+    constexpr size_t kSizeClassGranularity = 64;
+    constexpr size_t kNumberOfSizeClasses = 16; // Up to 1024 bytes
+    constexpr size_t kMaxCachedBlocksPerClass = 4096;
+    constexpr uint32_t kUnpooled = ~0u;
+
+    struct ThreadCache;
+
+    struct BlockHeader {
+        ThreadCache* owner;
+        uint32_t sizeClass;
+        uint32_t alignment;
+    };
+    static_assert(sizeof(BlockHeader) <= kHeaderSize);
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    // The caches are never freed, they are reused by the new threads once the owner thread exits,
+    // so that the blocks that are deallocated in other threads can always find their owner.
+    struct alignas(64) ThreadCache {
+        FreeBlock* freeLists[kNumberOfSizeClasses] {};
+        size_t freeCounts[kNumberOfSizeClasses] {};
+        ThreadCache* nextIdle { nullptr };
+
+        alignas(64) std::atomic<FreeBlock*> remoteFreeList { nullptr };
+
+        void PushLocal(FreeBlock* block, uint32_t sizeClass)
+        {
+            if (freeCounts[sizeClass] >= kMaxCachedBlocksPerClass) {
+                ::operator delete(reinterpret_cast<char*>(block) - kHeaderSize);
+                return;
+            }
+            block->next = freeLists[sizeClass];
+            freeLists[sizeClass] = block;
+            ++freeCounts[sizeClass];
+        }
+
+        void PushRemote(FreeBlock* block)
+        {
+            FreeBlock* head = remoteFreeList.load(std::memory_order_relaxed);
+            do {
+                block->next = head;
+            } while (!remoteFreeList.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        void ReclaimRemote()
+        {
+            FreeBlock* block = remoteFreeList.exchange(nullptr, std::memory_order_acquire);
+            while (block != nullptr) {
+                FreeBlock* next = block->next;
+                auto* header = reinterpret_cast<BlockHeader*>(reinterpret_cast<char*>(block) - kHeaderSize);
+                PushLocal(block, header->sizeClass);
+                block = next;
+            }
+        }
+    };
+
+    struct CacheRegistry {
+        std::mutex mutex {};
+        ThreadCache* idleCaches { nullptr };
+
+        ThreadCache* Acquire()
+        {
+            std::unique_lock<std::mutex> lck(mutex);
+            if (idleCaches == nullptr) {
+                return new ThreadCache();
+            }
+            ThreadCache* cache = idleCaches;
+            idleCaches = cache->nextIdle;
+            cache->nextIdle = nullptr;
+            return cache;
+        }
+
+        void Recycle(ThreadCache* cache)
+        {
+            std::unique_lock<std::mutex> lck(mutex);
+            cache->nextIdle = idleCaches;
+            idleCaches = cache;
+        }
+    };
+
+    CacheRegistry& GetCacheRegistry()
+    {
+        // Never destroyed, the caches may be used by the threads which exit after main returns
+        static auto* registry = new CacheRegistry();
+        return *registry;
+    }
+
+    struct ThreadCacheHolder {
+        ThreadCache* cache { nullptr };
+
+        ~ThreadCacheHolder()
+        {
+            if (cache != nullptr) {
+                GetCacheRegistry().Recycle(cache);
+            }
+        }
+    };
+
+    thread_local ThreadCacheHolder tCacheHolder;
+
+    ThreadCache* GetThreadCache()
+    {
+        auto& holder = tCacheHolder;
+        if (holder.cache == nullptr) {
+            holder.cache = GetCacheRegistry().Acquire();
+        }
+        return holder.cache;
+    }
+
+}
+
+PoolTaskAllocator& PoolTaskAllocator::Get()
+{
+    static auto* allocator = new PoolTaskAllocator();
+    return *allocator;
+}
+
+void* PoolTaskAllocator::Allocate(size_t size, size_t alignment)
+{
+    uint32_t sizeClass = static_cast<uint32_t>((size + kSizeClassGranularity - 1) / kSizeClassGranularity - 1);
+    if (sizeClass >= kNumberOfSizeClasses || alignment > kHeaderSize) {
+        // Fallback to the global allocator, keep the header adjacent to the returned pointer
+        size_t offset = std::max(kHeaderSize, alignment);
+        auto* memory = static_cast<char*>(::operator new(size + offset, std::align_val_t(std::max(alignment, alignof(BlockHeader)))));
+        auto* header = reinterpret_cast<BlockHeader*>(memory + offset - kHeaderSize);
+        *header = BlockHeader { nullptr, kUnpooled, static_cast<uint32_t>(offset) };
+        return memory + offset;
+    }
+
+    ThreadCache* cache = GetThreadCache();
+    if (cache->freeLists[sizeClass] == nullptr) {
+        cache->ReclaimRemote();
+    }
+    FreeBlock* block = cache->freeLists[sizeClass];
+    if (block != nullptr) {
+        cache->freeLists[sizeClass] = block->next;
+        --cache->freeCounts[sizeClass];
+        auto* header = reinterpret_cast<BlockHeader*>(reinterpret_cast<char*>(block) - kHeaderSize);
+        header->owner = cache;
+        return block;
+    }
+
+    auto* memory = static_cast<char*>(::operator new(kHeaderSize + (sizeClass + 1) * kSizeClassGranularity));
+    *reinterpret_cast<BlockHeader*>(memory) = BlockHeader { cache, sizeClass, static_cast<uint32_t>(kHeaderSize) };
+    return memory + kHeaderSize;
+}
+
+void PoolTaskAllocator::Deallocate(void* ptr, size_t, size_t alignment)
+{
+    if (ptr == nullptr) {
+        return;
+    }
+    auto* header = reinterpret_cast<BlockHeader*>(static_cast<char*>(ptr) - kHeaderSize);
+    if (header->sizeClass == kUnpooled) {
+        ::operator delete(static_cast<char*>(ptr) - header->alignment, std::align_val_t(std::max(alignment, alignof(BlockHeader))));
+        return;
+    }
+
+    ThreadCache* cache = GetThreadCache();
+    auto* block = static_cast<FreeBlock*>(ptr);
+    if (header->owner == cache) {
+        cache->PushLocal(block, header->sizeClass);
+    } else {
+        header->owner->PushRemote(block);
+    }
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,212 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TPL/TaskGraph.h"
+#include "TPL/Algorithm.h"
+#include <stdexcept>
+
+namespace tpl {
+
+TaskGraph::~TaskGraph()
+{
+    assert(!isRunning_); // "The graph is destroyed while running"
+}
+
+TaskGraph::NodeId TaskGraph::AddNodeInternal(UniqueFunction<void()>&& functor, std::string&& name)
+{
+    assert(!isRunning_);
+    functors_.push_back(std::move(functor));
+    names_.push_back(std::move(name));
+    isBuilt_ = false;
+    return functors_.size() - 1;
+}
+
+void TaskGraph::AddEdge(NodeId from, NodeId to)
+{
+    assert(!isRunning_);
+    assert(from < functors_.size() && to < functors_.size());
+    edges_.emplace_back(from, to);
+    isBuilt_ = false;
+}
+
+bool TaskGraph::Build()
+{
+    assert(!isRunning_);
+    const size_t count = functors_.size();
+
+    // Counting sort of the edges by the source, into the CSR arrays
+    successorOffsets_.assign(count + 1, 0);
+    inDegrees_.assign(count, 0);
+    for (auto& [from, to] : edges_) {
+        ++successorOffsets_[from + 1];
+        ++inDegrees_[to];
+    }
+    for (size_t i = 0; i < count; ++i) {
+        successorOffsets_[i + 1] += successorOffsets_[i];
+    }
+    successors_.resize(edges_.size());
+    std::vector<size_t> cursors(successorOffsets_.begin(), successorOffsets_.end() - 1);
+    for (auto& [from, to] : edges_) {
+        successors_[cursors[from]++] = to;
+    }
+
+    roots_.clear();
+    for (NodeId node = 0; node < count; ++node) {
+        if (inDegrees_[node] == 0) {
+            roots_.push_back(node);
+        }
+    }
+
+    // Kahn's algorithm, all the nodes are visited if and only if there is no cycle
+    std::vector<uint32_t> inDegrees(inDegrees_);
+    std::vector<NodeId> ready(roots_);
+    size_t visitedCount = 0;
+    while (!ready.empty()) {
+        NodeId node = ready.back();
+        ready.pop_back();
+        ++visitedCount;
+        for (size_t i = successorOffsets_[node]; i < successorOffsets_[node + 1]; ++i) {
+            if (--inDegrees[successors_[i]] == 0) {
+                ready.push_back(successors_[i]);
+            }
+        }
+    }
+    isCyclic_ = visitedCount != count;
+
+    pendingCounts_.reset(new std::atomic<uint32_t>[count]);
+#if defined(TPL_ENABLE_TRACING)
+    traceIds_.resize(count);
+    for (auto& id : traceIds_) {
+        id = internal::NewTraceId();
+    }
+#endif
+    isBuilt_ = true;
+    return !isCyclic_;
+}
+
+Task<void> TaskGraph::Run(ITaskScheduler* scheduler, TaskPriority priority)
+{
+    auto& sched = internal::ResolveScheduler(scheduler);
+    if (!isBuilt_) {
+        Build();
+    }
+    bool wasRunning = isRunning_.exchange(true, std::memory_order_acquire);
+    assert(!wasRunning); // "The graph is run again before the last run is done"
+    (void)wasRunning;
+
+    auto result = internal::MakeProxyTask<void>(sched);
+    auto& future = const_cast<Future<void>&>(result.GetFuture());
+    if (isCyclic_ || functors_.empty()) {
+        isRunning_.store(false, std::memory_order_release);
+        if (isCyclic_) {
+            future.SetException(std::make_exception_ptr(std::logic_error("TaskGraph has a cycle")));
+        } else {
+            future.SetValue();
+        }
+        return result;
+    }
+
+    // The counters are published to the workers by scheduling the roots
+    for (size_t i = 0; i < functors_.size(); ++i) {
+        pendingCounts_[i].store(inDegrees_[i], std::memory_order_relaxed);
+    }
+    // One more for scheduling the roots, so the run is not completed before the loop below ends
+    remainingCount_.store(functors_.size() + 1, std::memory_order_relaxed);
+    hasException_.store(false, std::memory_order_relaxed);
+    exception_ = nullptr;
+    scheduler_ = &sched;
+    priority_ = priority;
+    result_ = result;
+#if defined(TPL_ENABLE_TRACING)
+    if (internal::IsTracing()) {
+        for (auto& [from, to] : edges_) {
+            internal::TraceDependency(traceIds_[from], traceIds_[to]);
+        }
+    }
+#endif
+
+    for (NodeId root : roots_) {
+        ScheduleNode(root, false);
+    }
+    if (remainingCount_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        Complete();
+    }
+    return result;
+}
+
+void TaskGraph::ScheduleNode(NodeId node, bool isContinuation)
+{
+#if defined(TPL_ENABLE_TRACING)
+    internal::TraceSchedule(traceIds_[node], names_[node]);
+#endif
+    try {
+        scheduler_->Schedule(UniqueFunction<void()>([this, node]() { ExecuteNode(node); }), ScheduleOptions { priority_, isContinuation });
+    } catch (const TaskRejectedException&) {
+        // The run is faulted with TaskRejectedException, like a rejected task. The node and its successors are skipped in this thread,
+        // so their counts are still dropped and the run is completed
+        if (!hasException_.exchange(true, std::memory_order_relaxed)) {
+            exception_ = std::current_exception();
+        }
+        ExecuteNode(node);
+    }
+}
+
+void TaskGraph::ExecuteNode(NodeId node)
+{
+    while (true) {
+        RunNode(node);
+        NodeId next = kNoNode;
+        for (size_t i = successorOffsets_[node]; i < successorOffsets_[node + 1]; ++i) {
+            NodeId successor = successors_[i];
+            if (pendingCounts_[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                if (next != kNoNode) {
+                    ScheduleNode(next, true);
+                }
+                next = successor;
+            }
+        }
+        // No successor is pending once the remaining count reaches 0, so completing is the last access of this run
+        if (remainingCount_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            Complete();
+            return;
+        }
+        if (next == kNoNode) {
+            return;
+        }
+        node = next;
+    }
+}
+
+void TaskGraph::RunNode(NodeId node)
+{
+    if (hasException_.load(std::memory_order_relaxed)) {
+        return;
+    }
+#if defined(TPL_ENABLE_TRACING)
+    internal::TaskTraceScope traceScope(traceIds_[node], names_[node]);
+#endif
+    try {
+        functors_[node]();
+    } catch (...) {
+        if (!hasException_.exchange(true, std::memory_order_relaxed)) {
+            exception_ = std::current_exception();
+        }
+    }
+}
+
+void TaskGraph::Complete()
+{
+    // The graph may be run again (or destroyed) once isRunning_ is cleared, so the state is moved out first
+    auto result = std::move(result_);
+    auto exception = std::move(exception_);
+    isRunning_.store(false, std::memory_order_release);
+    auto& future = const_cast<Future<void>&>(result.GetFuture());
+    if (exception != nullptr) {
+        internal::SetFailed(future, std::move(exception));
+    } else {
+        future.SetValue();
+    }
+}
+
+}
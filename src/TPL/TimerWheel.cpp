@@ -0,0 +1,212 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TPL/TimerWheel.h"
+#include <limits>
+
+namespace tpl {
+
+namespace {
+
+    constexpr uint64_t kNoWakeup = std::numeric_limits<uint64_t>::max();
+
+}
+
+TimerWheel::TimerWheel()
+    : startTime_ { Clock::now() }
+    , wakeupTick_ { kNoWakeup }
+{
+    thread_ = std::thread(&TimerWheel::TimerThreadRoutine, this);
+}
+
+TimerWheel::~TimerWheel()
+{
+    {
+        std::unique_lock<std::mutex> lck(mutex_);
+        isRunning_ = false;
+    }
+    cv_.notify_one();
+    thread_.join();
+    for (auto& [id, timer] : timers_) {
+        delete timer;
+    }
+}
+
+TimerWheel& TimerWheel::GetDefault()
+{
+    static TimerWheel wheel;
+    return wheel;
+}
+
+TimerWheel::TimerId TimerWheel::Add(Clock::duration delay, UniqueFunction<void()>&& callback)
+{
+    auto* timer = new Timer();
+    timer->callback = std::move(callback);
+    // Rounded up, so the timer never fires early
+    auto elapsed = Clock::now() + delay - startTime_;
+    auto ticks = std::chrono::ceil<std::chrono::milliseconds>(elapsed) / kTickDuration;
+    timer->deadline = static_cast<uint64_t>(std::max<decltype(ticks)>(ticks, 0));
+
+    TimerId id;
+    bool shouldNotify;
+    {
+        std::unique_lock<std::mutex> lck(mutex_);
+        id = nextId_++;
+        timer->id = id;
+        timers_.emplace(timer->id, timer);
+        Insert(timer);
+        shouldNotify = timer->deadline < wakeupTick_;
+    }
+    if (shouldNotify) {
+        cv_.notify_one();
+    }
+    // The timer may have fired already
+    return id;
+}
+
+bool TimerWheel::Cancel(TimerId id)
+{
+    Timer* timer;
+    {
+        std::unique_lock<std::mutex> lck(mutex_);
+        auto it = timers_.find(id);
+        if (it == timers_.end()) {
+            return false;
+        }
+        timer = it->second;
+        timers_.erase(it);
+        Unlink(timer);
+    }
+    // The callback is destroyed without the lock, since it may release the last reference of something
+    delete timer;
+    return true;
+}
+
+size_t TimerWheel::GetPendingCount() const
+{
+    std::unique_lock<std::mutex> lck(mutex_);
+    return timers_.size();
+}
+
+uint64_t TimerWheel::ToTick(Clock::time_point time) const
+{
+    return static_cast<uint64_t>(std::chrono::floor<std::chrono::milliseconds>(time - startTime_) / kTickDuration);
+}
+
+TimerWheel::Clock::time_point TimerWheel::ToTime(uint64_t tick) const
+{
+    return startTime_ + tick * kTickDuration;
+}
+
+void TimerWheel::Insert(Timer* timer)
+{
+    // The expired ones fire at the next tick
+    uint64_t deadline = std::max(timer->deadline, currentTick_ + 1);
+    uint64_t delta = deadline - currentTick_;
+    size_t level = 0;
+    while (level + 1 < kNumLevels && delta >= (uint64_t(1) << (kNumSlotBits * (level + 1)))) {
+        ++level;
+    }
+    // Beyond the range of the wheel, it's parked in the farthest slot, and re-inserted once the slot comes up
+    if (level + 1 == kNumLevels && delta >= (uint64_t(1) << (kNumSlotBits * kNumLevels))) {
+        deadline = currentTick_ + (uint64_t(1) << (kNumSlotBits * kNumLevels)) - 1;
+    }
+    auto& head = slots_[level][(deadline >> (kNumSlotBits * level)) & (kNumSlots - 1)];
+    timer->slot = &head;
+    timer->prev = nullptr;
+    timer->next = head;
+    if (head != nullptr) {
+        head->prev = timer;
+    }
+    head = timer;
+}
+
+void TimerWheel::Unlink(Timer* timer)
+{
+    if (timer->prev != nullptr) {
+        timer->prev->next = timer->next;
+    } else {
+        *timer->slot = timer->next;
+    }
+    if (timer->next != nullptr) {
+        timer->next->prev = timer->prev;
+    }
+    timer->prev = nullptr;
+    timer->next = nullptr;
+    timer->slot = nullptr;
+}
+
+void TimerWheel::Advance(uint64_t tick, std::vector<Timer*>& expired)
+{
+    if (timers_.empty()) {
+        currentTick_ = std::max(currentTick_, tick);
+        return;
+    }
+    while (currentTick_ < tick) {
+        uint64_t t = ++currentTick_;
+        // Moves the timers of the higher levels whose slots come up to the lower levels
+        for (size_t level = 1; level < kNumLevels && (t & ((uint64_t(1) << (kNumSlotBits * level)) - 1)) == 0; ++level) {
+            auto& head = slots_[level][(t >> (kNumSlotBits * level)) & (kNumSlots - 1)];
+            Timer* timer = head;
+            head = nullptr;
+            while (timer != nullptr) {
+                Timer* next = timer->next;
+                Insert(timer);
+                timer = next;
+            }
+        }
+        auto& head = slots_[0][t & (kNumSlots - 1)];
+        Timer* timer = head;
+        head = nullptr;
+        while (timer != nullptr) {
+            Timer* next = timer->next;
+            timer->slot = nullptr;
+            timers_.erase(timer->id);
+            expired.push_back(timer);
+            timer = next;
+        }
+    }
+}
+
+uint64_t TimerWheel::GetNextWakeupTick() const
+{
+    if (timers_.empty()) {
+        return kNoWakeup;
+    }
+    uint64_t nextCascade = (currentTick_ | (kNumSlots - 1)) + 1;
+    for (uint64_t t = currentTick_ + 1; t < nextCascade; ++t) {
+        if (slots_[0][t & (kNumSlots - 1)] != nullptr) {
+            return t;
+        }
+    }
+    return nextCascade;
+}
+
+void TimerWheel::TimerThreadRoutine()
+{
+    std::vector<Timer*> expired;
+    std::unique_lock<std::mutex> lck(mutex_);
+    while (isRunning_) {
+        Advance(ToTick(Clock::now()), expired);
+        if (!expired.empty()) {
+            wakeupTick_ = currentTick_;
+            lck.unlock();
+            for (auto* timer : expired) {
+                timer->callback();
+                delete timer;
+            }
+            expired.clear();
+            lck.lock();
+            continue;
+        }
+        wakeupTick_ = GetNextWakeupTick();
+        if (wakeupTick_ == kNoWakeup) {
+            cv_.wait(lck);
+        } else {
+            cv_.wait_until(lck, ToTime(wakeupTick_));
+        }
+    }
+}
+
+}
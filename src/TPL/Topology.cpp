@@ -0,0 +1,223 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TPL/Topology.h"
+#include <algorithm>
+#include <thread>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#endif
+
+namespace tpl {
+
+namespace {
+
+#if defined(__linux__)
+    const char* kCpuRoot = "/sys/devices/system/cpu/";
+
+    bool ReadLine(const std::string& path, std::string& line)
+    {
+        std::ifstream file(path);
+        return file && std::getline(file, line);
+    }
+
+    /// Parses the cpu list format, e.g. "0-3,8,10-11"
+    std::vector<int> ParseCpuList(const std::string& text)
+    {
+        std::vector<int> cpus;
+        std::stringstream stream(text);
+        std::string range;
+        while (std::getline(stream, range, ',')) {
+            if (range.empty()) {
+                continue;
+            }
+            auto dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    int ReadInt(const std::string& path, int fallback)
+    {
+        std::string line;
+        if (!ReadLine(path, line)) {
+            return fallback;
+        }
+        try {
+            return std::stoi(line);
+        } catch (...) {
+            return fallback;
+        }
+    }
+
+    /// The first cpu sharing the highest level cache with cpu
+    int ReadLastLevelCache(const std::string& cpuPath, int fallback)
+    {
+        int result = fallback;
+        int maxLevel = -1;
+        for (int index = 0;; ++index) {
+            std::string indexPath = cpuPath + "cache/index" + std::to_string(index) + "/";
+            int level = ReadInt(indexPath + "level", -1);
+            if (level < 0) {
+                break;
+            }
+            std::string shared;
+            if (level > maxLevel && ReadLine(indexPath + "shared_cpu_list", shared)) {
+                auto cpus = ParseCpuList(shared);
+                if (!cpus.empty()) {
+                    maxLevel = level;
+                    result = cpus.front();
+                }
+            }
+        }
+        return result;
+    }
+
+    int ReadNode(const std::string& cpuPath)
+    {
+        DIR* dir = opendir(cpuPath.c_str());
+        if (dir == nullptr) {
+            return 0;
+        }
+        int node = 0;
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() > 4 && name.compare(0, 4, "node") == 0 && std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+                node = std::stoi(name.substr(4));
+                break;
+            }
+        }
+        closedir(dir);
+        return node;
+    }
+
+    /// Returns an empty topology if /sys is unreadable or malformed, the flat one is used then
+    std::vector<CpuLocation> ReadTopology()
+    {
+        std::vector<CpuLocation> result;
+        std::string online;
+        if (!ReadLine(std::string(kCpuRoot) + "online", online)) {
+            return result;
+        }
+        try {
+            for (int cpu : ParseCpuList(online)) {
+                std::string cpuPath = std::string(kCpuRoot) + "cpu" + std::to_string(cpu) + "/";
+                CpuLocation location;
+                location.cpu = cpu;
+                int package = ReadInt(cpuPath + "topology/physical_package_id", 0);
+                int core = ReadInt(cpuPath + "topology/core_id", cpu);
+                location.core = (package << 16) | (core & 0xffff);
+                location.cache = ReadLastLevelCache(cpuPath, cpu);
+                location.node = ReadNode(cpuPath);
+                result.push_back(location);
+            }
+        } catch (const std::exception&) {
+            // Thrown by std::stoi, this may run in the static initialization, so it should never escape
+            result.clear();
+        }
+        return result;
+    }
+#endif
+
+}
+
+const CpuTopology& CpuTopology::Get()
+{
+    static CpuTopology topology;
+    return topology;
+}
+
+CpuTopology::CpuTopology()
+{
+#if defined(__linux__)
+    cpus_ = ReadTopology();
+#endif
+    if (cpus_.empty()) {
+        int count = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        for (int cpu = 0; cpu < count; ++cpu) {
+            cpus_.push_back(CpuLocation { cpu, cpu, 0, 0 });
+        }
+    }
+}
+
+const CpuLocation* CpuTopology::Find(int cpu) const
+{
+    auto it = std::find_if(cpus_.begin(), cpus_.end(), [cpu](const CpuLocation& location) { return location.cpu == cpu; });
+    return it == cpus_.end() ? nullptr : &*it;
+}
+
+std::vector<int> CpuTopology::GetNodes() const
+{
+    std::vector<int> nodes;
+    for (auto& location : cpus_) {
+        if (std::find(nodes.begin(), nodes.end(), location.node) == nodes.end()) {
+            nodes.push_back(location.node);
+        }
+    }
+    std::sort(nodes.begin(), nodes.end());
+    return nodes;
+}
+
+std::vector<int> CpuTopology::GetCpusOfNode(int node) const
+{
+    std::vector<int> cpus;
+    for (auto& location : cpus_) {
+        if (location.node == node) {
+            cpus.push_back(location.cpu);
+        }
+    }
+    return cpus;
+}
+
+CpuDistance CpuTopology::GetDistance(int cpu1, int cpu2) const
+{
+    const CpuLocation* a = Find(cpu1);
+    const CpuLocation* b = Find(cpu2);
+    if (a == nullptr || b == nullptr) {
+        return CpuDistance::kRemote;
+    }
+    if (a->core == b->core) {
+        return CpuDistance::kSameCore;
+    }
+    if (a->cache == b->cache) {
+        return CpuDistance::kSameCache;
+    }
+    if (a->node == b->node) {
+        return CpuDistance::kSameNode;
+    }
+    return CpuDistance::kRemote;
+}
+
+bool PinCurrentThread(const std::vector<int>& cpus)
+{
+#if defined(__linux__)
+    if (cpus.empty()) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+}
@@ -0,0 +1,288 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TPL/Tracing.h"
+#include "TPL/Scheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace tpl {
+
+#if defined(TPL_ENABLE_TRACING)
+namespace internal {
+
+    std::atomic_bool gIsTracing { false };
+
+}
+
+namespace {
+
+    using internal::TraceEventType;
+
+    struct TraceEvent {
+        uint64_t timestamp; // Nanoseconds since the epoch of the tracer
+        uint64_t taskId;
+        uint64_t otherId;
+        TraceEventType type;
+        char name[47]; // Truncated
+    };
+
+    /// Written by the owner thread only, the events are published by the release store of head
+    struct TraceBuffer {
+        TraceBuffer(size_t capacity, size_t index, bool isWorker)
+            : events(capacity)
+            , threadIndex { index }
+            , isWorkerThread { isWorker }
+        {
+        }
+
+        std::vector<TraceEvent> events;
+        std::atomic<uint64_t> head { 0 };
+        size_t threadIndex;
+        bool isWorkerThread;
+    };
+
+    struct TraceRegistry {
+        std::mutex mutex {};
+        std::vector<std::shared_ptr<TraceBuffer>> buffers {};
+        size_t capacityPerThread { 1 << 16 };
+        std::atomic<uint64_t> generation { 1 };
+        std::chrono::steady_clock::time_point epoch { std::chrono::steady_clock::now() };
+    };
+
+    TraceRegistry& GetRegistry()
+    {
+        static TraceRegistry registry;
+        return registry;
+    }
+
+    std::atomic<uint64_t> gNextTraceId { 1 };
+
+    struct ThreadTraceState {
+        std::shared_ptr<TraceBuffer> buffer {};
+        uint64_t generation { 0 };
+    };
+
+    thread_local ThreadTraceState tTraceState {};
+
+    /// The buffer of the calling thread, which is registered on the first use, and after the trace is cleared
+    TraceBuffer& GetThreadBuffer(TraceRegistry& registry)
+    {
+        uint64_t generation = registry.generation.load(std::memory_order_acquire);
+        if (tTraceState.generation != generation) {
+            std::unique_lock<std::mutex> lck(registry.mutex);
+            tTraceState.buffer = std::make_shared<TraceBuffer>(registry.capacityPerThread, registry.buffers.size(), GetCurrentTaskScheduler() != nullptr);
+            tTraceState.generation = registry.generation.load(std::memory_order_relaxed);
+            registry.buffers.push_back(tTraceState.buffer);
+        }
+        return *tTraceState.buffer;
+    }
+
+    void WriteEscaped(std::ostream& os, const char* text)
+    {
+        for (const char* c = text; *c != '\0'; ++c) {
+            if (*c == '"' || *c == '\\') {
+                os << '\\' << *c;
+            } else if (static_cast<unsigned char>(*c) < 0x20) {
+                os << ' ';
+            } else {
+                os << *c;
+            }
+        }
+    }
+
+    void WriteTimestamp(std::ostream& os, uint64_t nanoseconds)
+    {
+        // In microseconds
+        os << nanoseconds / 1000 << '.' << std::setw(3) << std::setfill('0') << nanoseconds % 1000;
+    }
+
+    struct CollectedEvent {
+        TraceEvent event;
+        size_t threadIndex;
+    };
+
+}
+
+namespace internal {
+
+    uint64_t NewTraceId()
+    {
+        return gNextTraceId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void RecordTraceEvent(TraceEventType type, uint64_t taskId, uint64_t otherId, const std::string* name)
+    {
+        auto& registry = GetRegistry();
+        auto& buffer = GetThreadBuffer(registry);
+        uint64_t head = buffer.head.load(std::memory_order_relaxed);
+        auto& event = buffer.events[head % buffer.events.size()];
+        event.timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - registry.epoch).count());
+        event.taskId = taskId;
+        event.otherId = otherId;
+        event.type = type;
+        size_t length = name == nullptr ? 0 : std::min(name->size(), sizeof(event.name) - 1);
+        if (length != 0) {
+            std::memcpy(event.name, name->data(), length);
+        }
+        event.name[length] = '\0';
+        buffer.head.store(head + 1, std::memory_order_release);
+    }
+
+}
+
+void StartTracing(size_t capacityPerThread)
+{
+    auto& registry = GetRegistry();
+    {
+        std::unique_lock<std::mutex> lck(registry.mutex);
+        if (registry.capacityPerThread != std::max<size_t>(capacityPerThread, 1)) {
+            // The buffers are reallocated with the new capacity
+            registry.capacityPerThread = std::max<size_t>(capacityPerThread, 1);
+            registry.generation.fetch_add(1, std::memory_order_release);
+        }
+    }
+    internal::gIsTracing.store(true, std::memory_order_relaxed);
+}
+
+void StopTracing()
+{
+    internal::gIsTracing.store(false, std::memory_order_relaxed);
+}
+
+void ClearTrace()
+{
+    auto& registry = GetRegistry();
+    std::unique_lock<std::mutex> lck(registry.mutex);
+    // The threads drop their buffers on the next event
+    registry.buffers.clear();
+    registry.generation.fetch_add(1, std::memory_order_release);
+}
+
+void WriteChromeTrace(std::ostream& os)
+{
+    auto& registry = GetRegistry();
+    std::vector<CollectedEvent> events;
+    std::vector<std::shared_ptr<TraceBuffer>> buffers;
+    {
+        std::unique_lock<std::mutex> lck(registry.mutex);
+        buffers = registry.buffers;
+    }
+    for (auto& buffer : buffers) {
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t capacity = buffer->events.size();
+        for (uint64_t i = head > capacity ? head - capacity : 0; i < head; ++i) {
+            events.push_back(CollectedEvent { buffer->events[i % capacity], buffer->threadIndex });
+        }
+    }
+    std::stable_sort(events.begin(), events.end(), [](const CollectedEvent& a, const CollectedEvent& b) { return a.event.timestamp < b.event.timestamp; });
+
+    // Where the slices begin and end, to draw the dependency arrows from the end of the parent to the begin of the child
+    struct Location {
+        uint64_t timestamp;
+        size_t threadIndex;
+    };
+    std::unordered_map<uint64_t, Location> begins;
+    std::unordered_map<uint64_t, Location> ends;
+    for (auto& collected : events) {
+        if (collected.event.type == TraceEventType::kBegin) {
+            begins[collected.event.taskId] = Location { collected.event.timestamp, collected.threadIndex };
+        } else if (collected.event.type == TraceEventType::kEnd) {
+            ends[collected.event.taskId] = Location { collected.event.timestamp, collected.threadIndex };
+        }
+    }
+
+    const char* separator = "\n";
+    auto beginEvent = [&os, &separator](const char* phase, uint64_t timestamp, size_t threadIndex) {
+        os << separator << "{\"ph\":\"" << phase << "\",\"pid\":1,\"tid\":" << threadIndex << ",\"ts\":";
+        WriteTimestamp(os, timestamp);
+        separator = ",\n";
+    };
+
+    os << "{\"traceEvents\":[";
+    for (auto& buffer : buffers) {
+        os << separator << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadIndex << ",\"name\":\"thread_name\",\"args\":{\"name\":\""
+           << (buffer->isWorkerThread ? "TPL worker " : "Thread ") << buffer->threadIndex << "\"}}";
+        separator = ",\n";
+    }
+    uint64_t edgeId = 0;
+    for (auto& [event, threadIndex] : events) {
+        switch (event.type) {
+        case TraceEventType::kSchedule:
+            beginEvent("i", event.timestamp, threadIndex);
+            os << ",\"s\":\"t\",\"cat\":\"schedule\",\"name\":\"Schedule\",\"args\":{\"task\":" << event.taskId << "}}";
+            beginEvent("s", event.timestamp, threadIndex);
+            os << ",\"cat\":\"queue\",\"name\":\"Queue\",\"id\":" << event.taskId << "}";
+            break;
+        case TraceEventType::kBegin:
+            beginEvent("B", event.timestamp, threadIndex);
+            os << ",\"cat\":\"task\",\"name\":\"";
+            if (event.name[0] != '\0') {
+                WriteEscaped(os, event.name);
+            } else {
+                os << "Task " << event.taskId;
+            }
+            os << "\",\"args\":{\"task\":" << event.taskId << "}}";
+            beginEvent("f", event.timestamp, threadIndex);
+            os << ",\"bp\":\"e\",\"cat\":\"queue\",\"name\":\"Queue\",\"id\":" << event.taskId << "}";
+            break;
+        case TraceEventType::kEnd:
+            beginEvent("E", event.timestamp, threadIndex);
+            os << "}";
+            break;
+        case TraceEventType::kDependency: {
+            auto parent = ends.find(event.otherId);
+            auto child = begins.find(event.taskId);
+            if (parent == ends.end() || child == begins.end()) {
+                break;
+            }
+            ++edgeId;
+            // Inside the slice of the parent, so the arrow is bound to it
+            beginEvent("s", parent->second.timestamp > 0 ? parent->second.timestamp - 1 : 0, parent->second.threadIndex);
+            os << ",\"cat\":\"dependency\",\"name\":\"Dependency\",\"id\":" << edgeId << "}";
+            beginEvent("f", child->second.timestamp, child->second.threadIndex);
+            os << ",\"bp\":\"e\",\"cat\":\"dependency\",\"name\":\"Dependency\",\"id\":" << edgeId << "}";
+            break;
+        }
+        }
+    }
+    os << "\n]}\n";
+}
+#else
+void StartTracing(size_t)
+{
+}
+
+void StopTracing()
+{
+}
+
+void ClearTrace()
+{
+}
+
+void WriteChromeTrace(std::ostream& os)
+{
+    os << "{\"traceEvents\":[]}\n";
+}
+#endif
+
+bool WriteChromeTrace(const std::string& path)
+{
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+    WriteChromeTrace(file);
+    return static_cast<bool>(file);
+}
+
+}
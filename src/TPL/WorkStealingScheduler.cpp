@@ -0,0 +1,11 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TPL/WorkStealingScheduler.h"
+
+namespace tpl {
+
+thread_local WorkStealingTaskScheduler::Worker* WorkStealingTaskScheduler::tCurrentWorker_ { nullptr };
+
+}
\ No newline at end of file